@@ -1,14 +1,95 @@
 """Read and write MAE files using the maeparser library."""
 
+import asyncio
 import pathlib
+import sys
+import tempfile
 import typing
+import uuid
 
 
-def read_mae(path: str | pathlib.Path) -> list[dict[str, typing.Any]]:
+def read_mae(
+    path: str | pathlib.Path,
+    cache: bool = False,
+    return_hashes: bool = False,
+    hash_coordinates: bool = True,
+    hash_display: bool = True,
+    start: int | None = None,
+    stop: int | None = None,
+    step: int | None = None,
+    lazy: bool = False,
+    pipelined: bool = False,
+    chunk_queue_depth: int = 16,
+    block_queue_depth: int = 256,
+    validate: bool = False,
+    on_error: typing.Literal["raise", "skip"] = "raise",
+    n_threads: int = 1,
+    bool_format: typing.Literal["list", "numpy", "packed"] = "list",
+    column_format: typing.Literal["list", "numpy"] = "list",
+) -> list[dict[str, typing.Any]] | tuple:
     """Read an MAE file and return a dictionary with the parsed data.
 
     Args:
         path: The path to the MAE or GZipped MAE file.
+        cache: Whether to store the parsed structures in a binary columnar cache
+            alongside the file (`<path>.maebin`), and to read them from it on
+            subsequent calls. The cache is memory-mapped, and is only used while it
+            matches the size, modification time and a hash of the MAE file.
+        return_hashes: Whether to also return a 64-bit content hash of each
+            structure, computed natively from the typed property values. See
+            `hash_structures` for details.
+        hash_coordinates: Whether the hashes should include the atom coordinates.
+        hash_display: Whether the hashes should include display-only properties,
+            such as colors, labels and representations.
+        start: The index of the first structure to read.
+        stop: The index to stop reading structures at (exclusive).
+        step: The step between the indices of the structures to read, which must be
+            positive. `start`, `stop` and `step` follow the semantics of Python
+            slices. Skipped structures are only scanned for block boundaries rather
+            than parsed, and if the file has an up to date index (see `index_mae`),
+            they are not read at all.
+        lazy: Whether to return dictionary-like `Structure` objects rather than
+            dictionaries. The title, props, atoms and bonds of each structure are
+            only converted to Python objects when first accessed, so workloads that
+            only read e.g. titles or scores never pay for converting the atoms.
+            Structures can be passed to `write_mae`, and are written without any
+            conversion if none of their props, atoms or bonds were accessed.
+        pipelined: Whether to read and decompress the file, parse structures and
+            convert them to Python objects concurrently on separate threads, so
+            that reading large (especially GZipped) files takes about as long as
+            the slowest of these stages rather than all three combined.
+        chunk_queue_depth: The maximum number of decompressed 1 MiB chunks waiting
+            to be parsed when `pipelined` is true.
+        block_queue_depth: The maximum number of parsed structures waiting to be
+            converted when `pipelined` is true.
+        validate: Whether to check each structure read as described in
+            `validate_mae`, raising a `ValueError` whose `errors` attribute lists
+            every problem found if any structure is invalid. Structures are always
+            parsed from the file rather than read from the cache when validating.
+        on_error: What to do when a structure cannot be read. `"raise"` raises
+            an error, while `"skip"` skips the structure, resynchronizing at the
+            next `f_m_ct` block at the start of a line, and continues reading.
+            Structures which fail validation are also skipped. When skipping, the
+            file is never read from or stored in the cache, and is not pipelined.
+        n_threads: The number of threads to convert structures to Python objects
+            on. Conversion only runs in parallel on free-threaded builds of Python
+            (e.g. 3.13t) with the GIL disabled, so this is ignored otherwise.
+        bool_format: How `b_` atom and bond columns are returned. `"list"` returns
+            lists of bools with `None` for undefined values. `"numpy"` returns a
+            tuple of a numpy `bool_` array of the values and a numpy `bool_` mask of
+            the undefined values, or `None` if every value is defined. `"packed"`
+            returns a `PackedBits`, storing eight values per byte (see `pack_bits`),
+            which suits very large systems. Any of these can be passed back to
+            `write_mae`.
+        column_format: How the other atom and bond columns are returned. `"list"`
+            returns lists with `None` for undefined values. `"numpy"` returns a
+            tuple of a dense array of the values (a numpy array, or a list of
+            strings for `s_` columns), holding an arbitrary value wherever undefined,
+            and a numpy `bool_` mask of the undefined values, or `None` if every
+            value is defined. `b_` columns are then returned as with
+            `bool_format="numpy"` unless `bool_format="packed"`. Structures are
+            parsed from the file rather than read from the cache unless both formats
+            are `"list"`.
 
     Returns:
         A list of data for each structure in the MAE file. Each structure is a
@@ -18,26 +99,334 @@ def read_mae(path: str | pathlib.Path) -> list[dict[str, typing.Any]]:
             - `atoms`: A list of atoms in the structure.
             - `bonds`: A list of bonds in the structure.
             - `props`: A dictionary of top level properties of the structure.
+
+        If `return_hashes` is true, a tuple of the structures and their hashes.
+        If `on_error` is `"skip"`, the structures (and hashes) are followed by a
+        list of the problems which caused structures to be skipped, each with the
+        index of the structure in the file (`structure`), its offset in the
+        decompressed file (`offset`) and the error message (`message`).
     """
+    from .pymaeparser_ext import BoolFormat, ColumnFormat, ReadOptions
+    from .pymaeparser_ext import count_structures as count_structures_ext
     from .pymaeparser_ext import read_mae as read_mae_ext
 
-    structures = read_mae_ext(str(path))
+    if on_error not in ("raise", "skip"):
+        raise ValueError(f"Unsupported on_error value: {on_error}")
+    if bool_format not in ("list", "numpy", "packed"):
+        raise ValueError(f"Unsupported bool_format value: {bool_format}")
+    if column_format not in ("list", "numpy"):
+        raise ValueError(f"Unsupported column_format value: {column_format}")
 
-    for structure in structures:
-        if "title" not in structure:
-            structure["title"] = None
-        if "atoms" not in structure:
-            structure["atoms"] = {}
-        if "bonds" not in structure:
-            structure["bonds"] = {}
-        if "props" not in structure:
-            structure["props"] = {}
+    start, stop, step = _normalize_slice(
+        start, stop, step, lambda: count_structures_ext(str(path))
+    )
 
-    return structures
+    options = ReadOptions()
+    options.cache = cache
+    options.return_hashes = return_hashes
+    options.hash_coordinates = hash_coordinates
+    options.hash_display = hash_display
+    options.start = start
+    if stop is not None:
+        options.stop = stop
+    options.step = step
+    options.lazy = lazy
+    options.pipelined = pipelined
+    options.chunk_queue_depth = chunk_queue_depth
+    options.block_queue_depth = block_queue_depth
+    options.validate = validate
+    options.skip_errors = on_error == "skip"
+    options.n_threads = n_threads if not _is_gil_enabled() else 1
+    options.bool_format = getattr(BoolFormat, bool_format)
+    options.column_format = getattr(ColumnFormat, column_format)
+
+    structures, hashes, errors = read_mae_ext(str(path), options)
+
+    if not lazy:
+        _fill_defaults(structures)
+
+    result = (
+        structures,
+        *([hashes] if return_hashes else []),
+        *([errors] if on_error == "skip" else []),
+    )
+    return result if len(result) > 1 else structures
+
+
+def pack_bits(values, nulls=None):
+    """Pack a `b_` atom or bond column into the form returned by `read_mae` with
+    `bool_format="packed"`, which can be written by `write_mae`.
+
+    Args:
+        values: The values of the column, as a sequence or array of bools.
+        nulls: A mask of the undefined values of the column, or `None` if every
+            value is defined.
+
+    Returns:
+        A `PackedBits` storing the values, and the mask if any, eight per byte in
+        little-endian bit order (i.e. as `numpy.packbits(..., bitorder="little")`)
+        in its `bits` and `nulls` attributes. `unpack()` returns them as numpy
+        `bool_` arrays.
+    """
+    import numpy
+
+    from .pymaeparser_ext import PackedBits
+
+    values = numpy.asarray(values, dtype=bool)
+
+    if nulls is not None:
+        nulls = numpy.packbits(numpy.asarray(nulls, dtype=bool), bitorder="little")
+
+    return PackedBits(numpy.packbits(values, bitorder="little"), len(values), nulls)
+
+
+def read_mae_ragged(path: str | pathlib.Path) -> dict[str, dict[str, typing.Any]]:
+    """Read an MAE file into tables of contiguous columns spanning every structure.
+
+    The CT properties, atoms and bonds of all structures are each gathered into a
+    single table, where the rows of each structure are stored contiguously and
+    `offsets` marks the boundaries between structures (a CSR layout), e.g. the
+    atoms of structure `i` are rows `offsets[i]:offsets[i + 1]` of each column.
+    This avoids creating a dictionary and lists per structure.
+
+    Args:
+        path: The path to the MAE or GZipped MAE file.
+
+    Returns:
+        A dictionary with `props`, `atoms` and `bonds` tables. Each table is a
+        dictionary of:
+
+            - `offsets`: A uint64 array of the first row of each structure,
+              followed by the total number of rows.
+            - `present`: A bool array of whether each structure has the table.
+            - `columns`: The values of each property across all rows, as numpy
+              arrays (bool, int32 or float64) or, for strings, lists. Undefined
+              values, including the rows of structures without the property, are
+              zero or `None`.
+            - `nulls`: A bool array for each property with undefined values, of
+              whether each value is undefined.
+    """
+    from .pymaeparser_ext import read_mae_ragged as read_mae_ragged_ext
+
+    return read_mae_ragged_ext(str(path))
+
+
+def bond_graph(
+    structure: dict[str, typing.Any], undirected: bool = True
+) -> dict[str, typing.Any]:
+    """Compute the bond graph of a structure as numpy arrays.
+
+    Atoms are numbered from zero. Bonds listed in both directions in the `bonds`
+    table are only included once.
+
+    Args:
+        structure: The structure, as returned by `read_mae` with any
+            `column_format`, or in any of the forms accepted by `write_mae`.
+        undirected: Whether `edge_index` should contain each bond in both
+            directions, as expected by most graph neural network libraries.
+
+    Returns:
+        A dictionary containing:
+
+            - `edge_index`: A `(2, E)` int64 array of the source and target atom
+              of each edge.
+            - `order`: An int32 array of the bond order of each edge.
+            - `indptr`, `indices`: The neighbors of each atom in CSR form, i.e.
+              the neighbors of atom `i` are `indices[indptr[i]:indptr[i + 1]]`.
+            - `atom_offsets`, `edge_offsets`: `[0, n_atoms]` and `[0, E]`, see
+              `read_mae_graphs`.
+    """
+    from .pymaeparser_ext import bond_graph as bond_graph_ext
+
+    atoms = structure.get("atoms") or {}
+    bonds = structure.get("bonds") or {}
+
+    return bond_graph_ext(atoms, bonds, undirected)
+
+
+def read_mae_graphs(
+    path: str | pathlib.Path, undirected: bool = True
+) -> dict[str, typing.Any]:
+    """Read the bond graphs of every structure in an MAE file as one batched graph.
+
+    The structures are never converted to Python objects. The atoms of each
+    structure are numbered after those of the structures before it, so that the
+    result can be passed directly to graph neural network loaders as a batch of
+    disconnected graphs.
+
+    Args:
+        path: The path to the MAE or GZipped MAE file.
+        undirected: Whether `edge_index` should contain each bond in both
+            directions.
+
+    Returns:
+        The batched graph in the same format as `bond_graph`, where `atom_offsets`
+        and `edge_offsets` contain the first atom and edge of each structure,
+        followed by the total number of atoms and edges.
+    """
+    from .pymaeparser_ext import read_mae_graphs as read_mae_graphs_ext
+
+    return read_mae_graphs_ext(str(path), undirected)
+
+
+def create_shared_dataset(path: str | pathlib.Path, name: str | None = None):
+    """Parse an MAE file once into a columnar dataset in POSIX shared memory.
+
+    Other processes, e.g. the workers of a PyTorch `DataLoader`, can attach to the
+    dataset by name using `attach_shared_dataset`, or by receiving a pickled
+    dataset, rather than each re-reading and re-parsing the file. The dataset
+    supports `len(dataset)`, `dataset[i]` (returning a structure in the same
+    format as `read_mae`) and `dataset.table("atoms")` (returning read-only
+    zero-copy numpy views of a table in the same format as `read_mae_ragged`).
+
+    The shared memory segment persists until `dataset.unlink()` is called, which
+    should be done by the process that created it once it is no longer needed.
+
+    Args:
+        path: The path to the MAE or GZipped MAE file.
+        name: The name of the shared memory segment to create. By default, a
+            unique name is generated.
+
+    Returns:
+        The dataset.
+    """
+    from .pymaeparser_ext import SharedDataset
+
+    name = f"pymaeparser-{uuid.uuid4().hex}" if name is None else name
+    return SharedDataset.create(str(path), name)
+
+
+def attach_shared_dataset(name: str):
+    """Attach to a dataset in shared memory created by `create_shared_dataset`.
+
+    Args:
+        name: The name of the dataset, i.e. `dataset.name`.
+
+    Returns:
+        The dataset.
+    """
+    from .pymaeparser_ext import SharedDataset
+
+    return SharedDataset.attach(name)
+
+
+class MaeDataset:
+    """Random access to the structures of an MAE file without reading all of them.
+
+    The file is indexed (see `index_mae`) the first time it is opened, after which
+    each access seeks to the structure and parses only it. GZipped files are
+    decompressed from the closest checkpoint stored in the index, which is at most
+    around 1 MiB of decompressed data before the structure. Recently accessed
+    structures are cached, and datasets can be pickled to send them to the
+    workers of a PyTorch `DataLoader`.
+
+    Args:
+        path: The path to the MAE or GZipped MAE file.
+        cache_size: The maximum number of parsed structures to cache.
+        lazy: Whether to return `Structure` objects rather than dictionaries,
+            as in `read_mae`.
+    """
+
+    def __init__(
+        self, path: str | pathlib.Path, cache_size: int = 128, lazy: bool = False
+    ):
+        from .pymaeparser_ext import MaeDataset as MaeDatasetExt
+
+        self._dataset = MaeDatasetExt(str(path), cache_size, lazy)
+        self._lazy = lazy
+
+    def __len__(self) -> int:
+        return len(self._dataset)
+
+    def __getitem__(self, index: int | slice):
+        if isinstance(index, slice):
+            return [self[i] for i in range(*index.indices(len(self)))]
+
+        structure = self._dataset[index]
+
+        if not self._lazy:
+            _fill_defaults([structure])
+
+        return structure
+
+    def __iter__(self):
+        for i in range(len(self)):
+            yield self[i]
+
+
+def hash_structures(
+    path: str | pathlib.Path, coordinates: bool = True, display: bool = True
+) -> list[int]:
+    """Compute a 64-bit content hash of each structure in an MAE file.
+
+    The hashes are computed natively from the typed values of the CT, atom and
+    bond properties, without converting the structures to Python objects, and are
+    much faster to compare than the structure dictionaries themselves.
+
+    Args:
+        path: The path to the MAE or GZipped MAE file.
+        coordinates: Whether to include the atom coordinates in the hashes.
+        display: Whether to include display-only properties, such as colors,
+            labels and representations, in the hashes.
+
+    Returns:
+        The hash of each structure in the file.
+    """
+    from .pymaeparser_ext import hash_structures as hash_structures_ext
+
+    return hash_structures_ext(str(path), coordinates, display)
+
+
+def validate_mae(path: str | pathlib.Path) -> list:
+    """Check the structures in an MAE file for problems, without converting them.
+
+    The checks are that:
+        - the atoms have the `r_m_x_coord`, `r_m_y_coord`, `r_m_z_coord` and
+          `i_m_atomic_number` properties, and the bonds the `i_m_from`, `i_m_to` and
+          `i_m_order` properties.
+        - every atom or bond property has a value for each atom or bond.
+        - every bond joins two atoms in `1..n_atoms`.
+
+    Args:
+        path: The path to the MAE or GZipped MAE file.
+
+    Returns:
+        The problems found. Each has the index of the structure in the file
+        (`structure`), its offset in the decompressed file (`offset`) and a
+        description of the problem (`message`).
+    """
+    from .pymaeparser_ext import validate_mae as validate_mae_ext
+
+    return validate_mae_ext(str(path))
+
+
+def index_mae(path: str | pathlib.Path) -> int:
+    """Create an index of the offsets of the structures in an MAE file.
+
+    The index is stored alongside the file (`<path>.maeidx`) and is only used while
+    it matches the size, modification time and a hash of the MAE file. It allows
+    `read_mae` and `MaeDataset` to seek directly to the structures selected by
+    `start`, `stop` and `step`, and structures to be counted without scanning the
+    file. For GZipped files, the index also stores checkpoints from which
+    decompression can resume, around every 1 MiB of decompressed data.
+
+    Args:
+        path: The path to the MAE or GZipped MAE file.
+
+    Returns:
+        The number of structures indexed.
+    """
+    from .pymaeparser_ext import index_mae as index_mae_ext
+
+    return index_mae_ext(str(path))
 
 
 def write_mae(
-    structures: list[dict[str, typing.Any]], path: str | pathlib.Path
+    structures: list[dict[str, typing.Any]],
+    path: str | pathlib.Path,
+    n_threads: int = 1,
+    float_format: typing.Literal["fixed", "shortest"] | dict[str, int] = "fixed",
+    validate: bool = False,
 ) -> dict[str, typing.Any]:
     """Write a dictionary with the structure data to an MAE file.
 
@@ -49,22 +438,554 @@ def write_mae(
 
     Each value of `atoms` and `bonds` should be a dictionary of lists, with keys
     corresponding to property names, and values corresponding to the property values.
-    All lists must have the same length.
+    All lists must have the same length. Columns may instead be given in any of the
+    forms returned by `read_mae` with `column_format` or `bool_format`, i.e. a dense
+    numpy array, a tuple of a dense array and a mask of undefined values, or for `b_`
+    columns a `PackedBits`, which are converted without checking each value for
+    `None`.
 
     `props` should be a dictionary values, rather than lists.
+
+    Args:
+        structures: The structures to write.
+        path: The path to the MAE or GZipped MAE file to write.
+        n_threads: The number of threads to format structures on. Values greater
+            than one format structures on a pool of worker threads while the next
+            structures are converted, producing byte-identical output.
+        float_format: How to format real values. `"fixed"` uses maeparser's
+            formatting with six decimal places, while `"shortest"` writes the
+            shortest representation that round-trips exactly. Alternatively, a
+            dictionary of glob patterns (e.g. `"r_m_*_coord"`) and the number of
+            decimal places to write matching properties with, where properties
+            matching no pattern are written using the shortest representation.
+        validate: Whether to check each structure as described in `validate_mae`
+            before writing it. If any structure is invalid, no file is written and
+            a `ValueError` whose `errors` attribute lists every problem found is
+            raised.
     """
     from .pymaeparser_ext import write_mae as write_mae_ext
 
     for structure in structures:
-        found_keys = {*structure}
-        allowed_keys = {"title", "atoms", "bonds", "props"}
+        _check_structure_keys(structure)
+
+    if float_format == "fixed":
+        float_precision = None
+    elif float_format == "shortest":
+        float_precision = []
+    elif isinstance(float_format, dict):
+        float_precision = [*float_format.items()]
+    else:
+        raise ValueError(f"Unsupported float format: {float_format}")
+
+    return write_mae_ext(structures, str(path), n_threads, float_precision, validate)
+
+
+class MaeWriter:
+    """Write structures to an MAE file one at a time.
+
+    Structures can either be written from dictionaries or `Structure` objects, as
+    in `write_mae`, or forwarded unchanged from the raw bytes yielded by
+    `iter_mae_raw` without being parsed or re-formatted. The writer can be used as
+    a context manager, which closes the file on exit.
+
+    Args:
+        path: The path to the MAE or GZipped MAE file to write.
+    """
+
+    def __init__(self, path: str | pathlib.Path):
+        from .pymaeparser_ext import MaeWriter as MaeWriterExt
+
+        self._writer = MaeWriterExt(str(path))
+
+    def write(self, structure: dict[str, typing.Any]):
+        """Write a structure, formatted as by `write_mae`."""
+        _check_structure_keys(structure)
+        self._writer.write(structure)
+
+    def write_raw(self, text: bytes | memoryview | str):
+        """Write the text of an `f_m_ct` block verbatim, from the start of its name
+        to its closing brace, e.g. as yielded by `iter_mae_raw`."""
+        if isinstance(text, str):
+            text = text.encode()
+
+        self._writer.write_raw(text)
+
+    def close(self):
+        """Flush and close the file."""
+        self._writer.close()
 
-        if len(found_keys - allowed_keys) > 0:
-            raise ValueError(
-                f"Unexpected keys in structure: {found_keys - allowed_keys}"
-            )
+    def __enter__(self) -> "MaeWriter":
+        return self
 
-    return write_mae_ext(structures, str(path))
+    def __exit__(self, *args):
+        self.close()
+
+
+def iter_mae_raw(
+    path: str | pathlib.Path,
+) -> typing.Iterator[tuple[dict[str, typing.Any], memoryview]]:
+    """Iterate over the structures of an MAE file as their CT properties and raw
+    bytes, without parsing their atoms or bonds.
+
+    This suits services which route structures based on their title or a few
+    properties and then forward them unchanged, e.g. with `MaeWriter.write_raw`.
+
+    Args:
+        path: The path to the MAE or GZipped MAE file.
+
+    Returns:
+        An iterator of tuples of the CT properties of each structure, including its
+        title (`s_m_title`) and with `None` for undefined values, and a read-only
+        `memoryview` of the decompressed bytes of its `f_m_ct` block. The view
+        refers to the buffer the block was read into rather than a copy of it.
+    """
+    from .pymaeparser_ext import RawBlockReader
+
+    reader = RawBlockReader(str(path))
+
+    while (item := reader.next()) is not None:
+        yield item
+
+
+async def async_iter_mae(
+    path: str | pathlib.Path, batch_size: int = 64, lazy: bool = False
+) -> typing.AsyncIterator[dict[str, typing.Any]]:
+    """Iterate over the structures of an MAE file from an asyncio event loop.
+
+    The file is parsed on a native thread without holding the GIL, which wakes the
+    event loop when structures are available, so the event loop stays responsive
+    while large files are read. Parsed structures are converted to Python objects
+    on the event loop in batches of at most `batch_size`, yielding control between
+    batches.
+
+    Args:
+        path: The path to the MAE or GZipped MAE file.
+        batch_size: The maximum number of structures to convert at a time.
+        lazy: Whether to yield `Structure` objects rather than dictionaries, see
+            `read_mae`.
+
+    Yields:
+        Each structure in the file, see `read_mae`.
+    """
+    from .pymaeparser_ext import AsyncReader
+
+    loop = asyncio.get_running_loop()
+    ready = asyncio.Event()
+
+    reader = AsyncReader(
+        str(path), lambda: loop.call_soon_threadsafe(ready.set), lazy, 4 * batch_size
+    )
+
+    try:
+        while (structures := reader.take(batch_size)) is not None:
+            if len(structures) == 0:
+                await ready.wait()
+                ready.clear()
+                continue
+
+            if not lazy:
+                _fill_defaults(structures)
+
+            for structure in structures:
+                yield structure
+
+            await asyncio.sleep(0)
+    finally:
+        reader.close()
+
+
+async def async_read_mae(
+    path: str | pathlib.Path, lazy: bool = False
+) -> list[dict[str, typing.Any]]:
+    """Read an MAE file from an asyncio event loop, see `async_iter_mae`.
+
+    Args:
+        path: The path to the MAE or GZipped MAE file.
+        lazy: Whether to return `Structure` objects rather than dictionaries, see
+            `read_mae`.
+
+    Returns:
+        The structures in the file, see `read_mae`.
+    """
+    return [structure async for structure in async_iter_mae(path, lazy=lazy)]
+
+
+async def async_write_mae(
+    structures: typing.Iterable[dict[str, typing.Any]]
+    | typing.AsyncIterable[dict[str, typing.Any]],
+    path: str | pathlib.Path,
+    batch_size: int = 64,
+):
+    """Write structures to an MAE file from an asyncio event loop.
+
+    Structures are converted to MAE blocks on the event loop, yielding control
+    every `batch_size` structures, and are formatted and written on a native thread
+    without holding the GIL, so the event loop stays responsive while large files
+    are written.
+
+    Args:
+        structures: The structures to write, see `write_mae`. These may be produced
+            by an async iterator, e.g. `async_iter_mae`.
+        path: The path to the MAE or GZipped MAE file to write.
+        batch_size: The number of structures to convert between yielding control.
+    """
+    from .pymaeparser_ext import AsyncWriter
+
+    loop = asyncio.get_running_loop()
+    ready = asyncio.Event()
+
+    writer = AsyncWriter(
+        str(path), lambda: loop.call_soon_threadsafe(ready.set), 4 * batch_size
+    )
+
+    async def put(i: int, structure: dict[str, typing.Any]):
+        _check_structure_keys(structure)
+
+        while not writer.put(structure):
+            await ready.wait()
+            ready.clear()
+
+        if i % batch_size == batch_size - 1:
+            await asyncio.sleep(0)
+
+    try:
+        if isinstance(structures, typing.AsyncIterable):
+            i = 0
+            async for structure in structures:
+                await put(i, structure)
+                i += 1
+        else:
+            for i, structure in enumerate(structures):
+                await put(i, structure)
+
+        while not writer.finish():
+            await ready.wait()
+            ready.clear()
+    finally:
+        writer.close()
+
+
+def dedup_mae(
+    src: str | pathlib.Path,
+    dst: str | pathlib.Path,
+    key: str = "content",
+    coordinates: bool = True,
+    display: bool = True,
+    max_memory_hashes: int | None = None,
+    spill_dir: str | pathlib.Path | None = None,
+) -> int:
+    """Copy the structures of an MAE file to a new file, skipping duplicates.
+
+    Structures are streamed from `src` one at a time, and only the first
+    occurrence of each is written to `dst`, so memory use is bounded by the set of
+    keys seen so far rather than by the number of structures.
+
+    Args:
+        src: The path to the MAE or GZipped MAE file to read.
+        dst: The path to the MAE or GZipped MAE file to write.
+        key: Either `"content"` to compare structures by a 128-bit hash of their
+            content, or the name of a CT property (e.g. `"s_m_title"`) whose values
+            should be compared. Structures without the property are always kept.
+        coordinates: Whether to include atom coordinates when comparing by content.
+        display: Whether to include display-only properties when comparing by
+            content.
+        max_memory_hashes: The maximum number of keys to hold in memory before
+            spilling them to sorted files on disk. By default, all keys are held
+            in memory.
+        spill_dir: The directory to create a temporary spill directory in. By
+            default, the system temporary directory is used.
+
+    Returns:
+        The number of structures written.
+    """
+    from .pymaeparser_ext import dedup_mae as dedup_mae_ext
+
+    with tempfile.TemporaryDirectory(dir=spill_dir) as spill_directory:
+        return dedup_mae_ext(
+            str(src),
+            str(dst),
+            key,
+            coordinates,
+            display,
+            max_memory_hashes or 0,
+            spill_directory,
+        )
+
+
+def split_mae(
+    src: str | pathlib.Path,
+    dst: str | typing.Callable[[int], str | pathlib.Path],
+    chunk_size: int | None = None,
+    n_files: int | None = None,
+) -> list[pathlib.Path]:
+    """Split an MAE file into several files of consecutive structures.
+
+    The bytes of each structure are copied verbatim rather than parsed and
+    re-formatted, so splitting runs at close to disk speed and does not change how
+    any value is formatted.
+
+    Args:
+        src: The path to the MAE or GZipped MAE file to split.
+        dst: Either a format string for the path of each file, which is formatted
+            with the index of the file (e.g. `"shard-{:04d}.maegz"`), or a function
+            which returns the path of the file with a given index.
+        chunk_size: The maximum number of structures to write to each file.
+        n_files: The number of files to split the structures evenly between. The
+            structures in `src` are counted first. Exactly one of `chunk_size` and
+            `n_files` must be specified.
+
+    Returns:
+        The paths of the files that were written.
+    """
+    from .pymaeparser_ext import count_structures as count_structures_ext
+    from .pymaeparser_ext import split_mae as split_mae_ext
+
+    if (chunk_size is None) == (n_files is None):
+        raise ValueError("Exactly one of `chunk_size` and `n_files` must be specified")
+
+    if n_files is not None:
+        n_structures = count_structures_ext(str(src))
+        chunk_size = max(1, -(-n_structures // n_files))
+
+    output_path = dst if callable(dst) else dst.format
+
+    filenames = split_mae_ext(str(src), chunk_size, lambda i: str(output_path(i)))
+    return [pathlib.Path(filename) for filename in filenames]
+
+
+def concat_mae(
+    srcs: list[str | pathlib.Path], dst: str | pathlib.Path
+) -> int:
+    """Concatenate the structures of several MAE files into a single file.
+
+    The bytes of each structure are copied verbatim rather than parsed and
+    re-formatted.
+
+    Args:
+        srcs: The paths to the MAE or GZipped MAE files to concatenate.
+        dst: The path to the MAE or GZipped MAE file to write.
+
+    Returns:
+        The number of structures written.
+    """
+    from .pymaeparser_ext import concat_mae as concat_mae_ext
+
+    return concat_mae_ext([str(src) for src in srcs], str(dst))
+
+
+def slice_mae(
+    src: str | pathlib.Path,
+    dst: str | pathlib.Path,
+    start: int | None = None,
+    stop: int | None = None,
+    step: int | None = None,
+) -> int:
+    """Copy a slice of the structures of an MAE file to a new file.
+
+    The arguments follow the semantics of Python slices, e.g. `start=10, step=10`
+    copies every 10th structure starting from the 11th. The bytes of each
+    structure are copied verbatim rather than parsed and re-formatted.
+
+    Args:
+        src: The path to the MAE or GZipped MAE file to read.
+        dst: The path to the MAE or GZipped MAE file to write.
+        start: The index of the first structure to copy.
+        stop: The index to stop copying structures at (exclusive).
+        step: The step between the indices of the copied structures, which must be
+            positive.
+
+    Returns:
+        The number of structures written.
+    """
+    from .pymaeparser_ext import count_structures as count_structures_ext
+    from .pymaeparser_ext import slice_mae as slice_mae_ext
+
+    start, stop, step = _normalize_slice(
+        start, stop, step, lambda: count_structures_ext(str(src))
+    )
+    return slice_mae_ext(str(src), str(dst), start, stop, step)
+
+
+def patch_mae(
+    src: str | pathlib.Path,
+    dst: str | pathlib.Path,
+    updates: dict[int | str, dict[str, typing.Any]],
+) -> int:
+    """Copy the structures of an MAE file to a new file, setting CT properties of
+    selected structures.
+
+    Only the CT properties of the patched structures are rewritten. Their atoms and
+    bonds, and every other structure, are copied verbatim rather than parsed and
+    re-formatted, so patching a file takes about as long as copying it.
+
+    Args:
+        src: The path to the MAE or GZipped MAE file to read.
+        dst: The path to the MAE or GZipped MAE file to write, which must differ
+            from `src`.
+        updates: The properties to set, keyed by either the index of a structure in
+            the file, or a title to patch every structure with that title. Existing
+            properties are replaced in place, new properties are added after them,
+            and properties set to `None` are removed. Properties keyed by index are
+            applied after those keyed by title.
+
+    Returns:
+        The number of structures patched.
+    """
+    from .pymaeparser_ext import patch_mae as patch_mae_ext
+
+    if pathlib.Path(src).resolve() == pathlib.Path(dst).resolve():
+        raise ValueError("The source and destination files must differ")
+
+    return patch_mae_ext(str(src), str(dst), updates)
+
+
+def sort_mae(
+    src: str | pathlib.Path,
+    dst: str | pathlib.Path,
+    key: str,
+    descending: bool = False,
+    memory_limit: int = 2**30,
+    spill_dir: str | pathlib.Path | None = None,
+) -> int:
+    """Sort the structures of an MAE file by the value of a CT property.
+
+    Only the CT properties of each structure are parsed, and the bytes of each
+    structure are copied verbatim. Files larger than `memory_limit` are sorted in
+    runs that are spilled to disk and then merged, so files much larger than memory
+    can be sorted. The sort is stable.
+
+    Args:
+        src: The path to the MAE or GZipped MAE file to read.
+        dst: The path to the MAE or GZipped MAE file to write.
+        key: The name of the CT property to sort by, e.g. `"r_i_docking_score"`.
+            `s_` properties are compared as strings and any other property as a
+            number. Structures without the property, or with a NaN value, are
+            written last.
+        descending: Whether to sort in descending rather than ascending order.
+        memory_limit: The approximate number of bytes of structures to hold in
+            memory before spilling a sorted run to disk.
+        spill_dir: The directory to create a temporary spill directory in. By
+            default, the system temporary directory is used.
+
+    Returns:
+        The number of structures written.
+    """
+    from .pymaeparser_ext import sort_mae as sort_mae_ext
+
+    with tempfile.TemporaryDirectory(dir=spill_dir) as spill_directory:
+        return sort_mae_ext(
+            str(src), str(dst), key, descending, memory_limit, spill_directory
+        )
+
+
+def top_k_mae(
+    path: str | pathlib.Path, key: str, k: int, largest: bool = False
+) -> list[dict[str, typing.Any]]:
+    """Read the `k` structures of an MAE file with the best values of a CT property.
+
+    Only the CT properties of each structure are parsed while streaming through the
+    file, and only the key and location of the best structures are kept. The
+    selected structures are then read again and fully parsed, so memory use is
+    bounded by `k` rather than by the size of the file or of its structures.
+
+    Args:
+        path: The path to the MAE or GZipped MAE file.
+        key: The name of the CT property to rank by, e.g. `"r_i_docking_score"`.
+            `s_` properties are compared as strings and any other property as a
+            number. Structures without the property, or with a NaN value, are
+            never selected.
+        k: The maximum number of structures to return.
+        largest: Whether to select the structures with the largest rather than the
+            smallest values.
+
+    Returns:
+        The selected structures (see `read_mae`), best first. Ties are broken by
+        the order of the structures in the file.
+    """
+    from .pymaeparser_ext import top_k_mae as top_k_mae_ext
+
+    if k < 0:
+        raise ValueError("k must be non-negative")
+
+    structures = top_k_mae_ext(str(path), key, k, largest)
+    _fill_defaults(structures)
+
+    return structures
+
+
+def _is_gil_enabled() -> bool:
+    """Whether the GIL is enabled, which is always the case before Python 3.13."""
+    return getattr(sys, "_is_gil_enabled", lambda: True)()
+
+
+def _normalize_slice(
+    start: int | None,
+    stop: int | None,
+    step: int | None,
+    count: typing.Callable[[], int],
+) -> tuple[int, int | None, int]:
+    """Convert slice arguments to non-negative indices, only counting the number of
+    structures when a negative index requires it. An open `stop` is returned as
+    `None`, so that reading every structure is not mistaken for reading a slice."""
+    if step is not None and step <= 0:
+        raise ValueError("The slice step must be positive")
+
+    if (start is not None and start < 0) or (stop is not None and stop < 0):
+        return slice(start, stop, step).indices(count())
+
+    return start or 0, stop, step or 1
+
+
+def _check_structure_keys(structure: dict[str, typing.Any]):
+    """Raise an error if a structure dictionary contains unexpected keys."""
+    from .pymaeparser_ext import Structure
+
+    if isinstance(structure, Structure):
+        return
+
+    found_keys = {*structure}
+    allowed_keys = {"title", "atoms", "bonds", "props"}
+
+    if len(found_keys - allowed_keys) > 0:
+        raise ValueError(f"Unexpected keys in structure: {found_keys - allowed_keys}")
+
+
+def _fill_defaults(structures: list[dict[str, typing.Any]]):
+    """Add any keys missing from converted structures with their default values."""
+    for structure in structures:
+        if "title" not in structure:
+            structure["title"] = None
+        if "atoms" not in structure:
+            structure["atoms"] = {}
+        if "bonds" not in structure:
+            structure["bonds"] = {}
+        if "props" not in structure:
+            structure["props"] = {}
 
 
-__all__ = ["read_mae", "write_mae"]
+__all__ = [
+    "MaeDataset",
+    "MaeWriter",
+    "async_iter_mae",
+    "async_read_mae",
+    "async_write_mae",
+    "attach_shared_dataset",
+    "bond_graph",
+    "concat_mae",
+    "create_shared_dataset",
+    "dedup_mae",
+    "hash_structures",
+    "index_mae",
+    "iter_mae_raw",
+    "pack_bits",
+    "patch_mae",
+    "read_mae",
+    "read_mae_graphs",
+    "read_mae_ragged",
+    "slice_mae",
+    "sort_mae",
+    "split_mae",
+    "top_k_mae",
+    "validate_mae",
+    "write_mae",
+]
@@ -1,273 +1,6056 @@
 #include <nanobind/nanobind.h>
+#include <nanobind/ndarray.h>
+#include <nanobind/stl/function.h>
+#include <nanobind/stl/optional.h>
+#include <nanobind/stl/pair.h>
+#include <nanobind/stl/tuple.h>
 #include <nanobind/stl/vector.h>
 #include <nanobind/stl/string.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <list>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
 #include <boost/dynamic_bitset.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/iostreams/device/file.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
 
 #include <maeparser/MaeBlock.hpp>
 #include <maeparser/MaeConstants.hpp>
 #include <maeparser/Reader.hpp>
 #include <maeparser/Writer.hpp>
 
+#include <zlib.h>
+
 namespace nb = nanobind;
 
 
 /**
- * @brief Converts an indexed property list to a Python list
- * @tparam T The type of property (uint8_t, int, double, or std::string)
- * @param props The indexed property to convert
- * @param block_size The size of the block containing the properties
- * @return A Python list containing the property values, with None for undefined values
+ * @brief Checks whether a filename refers to a GZipped MAE file
+ * @param filename The filename to check
+ * @return True if the filename ends with .gz or .maegz (case insensitive)
  */
-template<typename T>
-nb::list convert_indexed_properties(const std::shared_ptr<schrodinger::mae::IndexedProperty<T> > &props,
-                                    const size_t block_size) {
-    nb::list result;
-    for (size_t i = 0; i < block_size; ++i) {
-        if (props->isDefined(i)) {
-            auto value = props->at(i);
+bool is_gzipped(const std::string &filename) {
+    const auto ends_with = [&filename](const std::string &suffix) {
+        return filename.size() >= suffix.size() &&
+               std::equal(suffix.rbegin(), suffix.rend(), filename.rbegin(), [](const char a, const char b) {
+                   return std::tolower(a) == std::tolower(b);
+               });
+    };
+    return ends_with(".gz") || ends_with(".maegz");
+}
 
-            if constexpr (std::is_same_v<T, uint8_t>) {
-                result.append(static_cast<bool>(value));
-            } else {
-                result.append(value);
-            }
-        } else {
-            result.append(nb::none());
+/**
+ * @brief Opens an input stream for an MAE file in the same way as schrodinger::mae::Reader does
+ * @param filename Path to the MAE file to read, which will be decompressed if it ends with .gz or .maegz
+ * @return The opened input stream
+ * @throws std::runtime_error If the file cannot be opened
+ */
+std::shared_ptr<std::istream> open_input_stream(const std::string &filename) {
+    const auto mode = std::ios_base::in | std::ios_base::binary;
+
+    if (is_gzipped(filename)) {
+        boost::iostreams::file_source source(filename, mode);
+
+        if (!source.is_open()) {
+            throw std::runtime_error("Could not open file for reading: " + filename);
         }
+
+        auto stream = std::make_shared<boost::iostreams::filtering_istream>();
+        stream->push(boost::iostreams::gzip_decompressor());
+        stream->push(source);
+        return stream;
     }
-    return result;
+
+    auto stream = std::make_shared<std::ifstream>(filename, mode);
+
+    if (!stream->is_open()) {
+        throw std::runtime_error("Could not open file for reading: " + filename);
+    }
+    return stream;
 }
 
 /**
- * @brief Adds all properties of a given type to a Python dictionary
- * @tparam T The type of properties to add (uint8_t, int, double, or std::string)
- * @param dict The Python dictionary to add properties to
- * @param props Map of property names to property values
- * @param block_size The size of the block containing the properties
+ * @brief Opens an output stream for an MAE file in the same way as schrodinger::mae::Writer does
+ * @param filename Path to the MAE file to write, which will be GZipped if it ends with .gz or .maegz
+ * @return The opened output stream
+ * @throws std::runtime_error If the file cannot be opened
  */
-template<typename T>
-void add_properties_to_dict(nb::dict &dict,
-                            const std::map<std::string, std::shared_ptr<schrodinger::mae::IndexedProperty<T> > > &props,
-                            size_t block_size) {
-    for (const auto &[key, value]: props) {
-        dict[key.c_str()] = convert_indexed_properties(value, block_size);
+std::shared_ptr<std::ostream> open_output_stream(const std::string &filename) {
+    const auto mode = std::ios_base::out | std::ios_base::binary;
+
+    if (is_gzipped(filename)) {
+        boost::iostreams::file_sink sink(filename, mode);
+
+        if (!sink.is_open()) {
+            throw std::runtime_error("Could not open file for writing: " + filename);
+        }
+
+        auto stream = std::make_shared<boost::iostreams::filtering_ostream>();
+        stream->push(boost::iostreams::gzip_compressor());
+        stream->push(sink);
+        return stream;
     }
+
+    auto stream = std::make_shared<std::ofstream>(filename, mode);
+
+    if (!stream->is_open()) {
+        throw std::runtime_error("Could not open file for writing: " + filename);
+    }
+    return stream;
 }
 
 /**
- * @brief Processes all property types for a block and adds them to a Python dictionary
- * @param dict The Python dictionary to add properties to
- * @param block The indexed block containing the properties
+ * @brief Returns a unique path alongside a file to write it to before renaming it into place
+ * @details The path ends with the same extension as the file, so that it is compressed in the same way (see
+ *          open_output_stream). It includes a random token, so that concurrent writers of the same file,
+ *          e.g. in other processes, never write to the same temporary file.
  */
-void process_block_properties(nb::dict &dict,
-                              const std::shared_ptr<const schrodinger::mae::IndexedBlock> &block) {
-    add_properties_to_dict(dict, block->getProperties<uint8_t>(), block->size());
-    add_properties_to_dict(dict, block->getProperties<int>(), block->size());
-    add_properties_to_dict(dict, block->getProperties<double>(), block->size());
-    add_properties_to_dict(dict, block->getProperties<std::string>(), block->size());
+std::string temporary_filename(const std::string &filename) {
+    static std::mt19937_64 generator(std::random_device{}());
+    static std::mutex mutex;
+
+    uint64_t token;
+    {
+        std::lock_guard lock(mutex);
+        token = generator();
+    }
+
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(token));
+
+    const std::filesystem::path path(filename);
+    const auto name = "." + path.filename().string() + "." + hex + ".tmp" + path.extension().string();
+
+    return (path.parent_path() / name).string();
 }
 
 /**
- * @brief Reads an MAE file and extracts structure information
- * @param filename Path to the MAE file to read
- * @return Vector of Python dictionaries, each containing information about a structure:
- *         - title: Structure title (if present)
- *         - props: Dictionary of structure properties
- *         - atoms: Dictionary of atom properties (if present)
- *         - bonds: Dictionary of bond properties (if present)
+ * @brief Returns an indexed block of a CT block, or nullptr if the CT block does not contain it
+ * @param block The CT block
+ * @param name The name of the indexed block, e.g. m_atom
+ * @return The indexed block, or nullptr if it is not present
  */
-std::vector<nb::dict> read_mae(const std::string &filename) {
-    schrodinger::mae::Reader reader(filename);
-    std::vector<nb::dict> structures;
+std::shared_ptr<const schrodinger::mae::IndexedBlock> get_indexed_block(const schrodinger::mae::Block &block,
+                                                                         const std::string &name) {
+    if (!block.hasIndexedBlock(name)) { return nullptr; }
+    return block.getIndexedBlock(name);
+}
 
-    while (const auto block = reader.next(schrodinger::mae::CT_BLOCK)) {
-        nb::dict structure;
+/**
+ * @brief Matches a property name against a glob pattern supporting '*' and '?' wildcards
+ * @param pattern The glob pattern, e.g. r_m_*_coord
+ * @param name The property name to match
+ * @return True if the whole name matches the pattern
+ */
+bool glob_match(const std::string &pattern, const std::string &name) {
+    size_t p = 0, n = 0, star = std::string::npos, star_n = 0;
 
-        if (block->hasStringProperty(schrodinger::mae::CT_TITLE)) {
-            structure["title"] = block->getStringProperty(schrodinger::mae::CT_TITLE);
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+            ++p;
+            ++n;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            star_n = n;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            n = ++star_n;
+        } else {
+            return false;
         }
+    }
+    while (p < pattern.size() && pattern[p] == '*') { ++p; }
+
+    return p == pattern.size();
+}
+
+/**
+ * @brief A top-level block of an MAE file, e.g. f_m_ct { ... }, as the raw bytes it was read from
+ */
+struct RawBlock {
+    std::string name; ///< The name of the block, or an empty string for the unnamed header block
+    uint64_t offset = 0; ///< The offset of the block in the decompressed file
+    std::string text; ///< The bytes of the block, from the start of its name to its closing brace
+    bool complete = true; ///< Whether the closing brace of the block was found
+};
+
+/**
+ * @brief Scans an MAE file for the boundaries of its top-level blocks without parsing their contents
+ * @details Only enough of the MAE grammar is tracked to find the braces which open and close blocks, i.e.
+ *          quoted strings, #-delimited comments, whitespace separated tokens and whether each token of a block
+ *          is a key, a value or the name of a sub-block, so scanning runs at close to the speed the file can be
+ *          read and decompressed at. Only a bare { or a name{ token in block name position opens a block, so
+ *          values containing braces are never mistaken for blocks.
+ */
+class BlockScanner {
+public:
+    /**
+     * @param stream The stream to scan
+     * @param resynchronize Whether an f_m_ct token at the start of a line inside another block should be
+     *        treated as the start of a new CT block, ending the current block as incomplete. This allows
+     *        reading to continue after a truncated or corrupt structure, including one truncated part way
+     *        through a quoted string.
+     */
+    explicit BlockScanner(std::shared_ptr<std::istream> stream, const bool resynchronize = false)
+        : m_stream(std::move(stream)), m_buffer(1 << 20), m_resynchronize(resynchronize) {
+    }
 
-        nb::dict props;
-        for (const auto &[k, v]: block->getProperties<uint8_t>()) { props[k.c_str()] = bool(v); }
-        for (const auto &[k, v]: block->getProperties<int>()) { props[k.c_str()] = v; }
-        for (const auto &[k, v]: block->getProperties<double>()) { props[k.c_str()] = v; }
-        for (const auto &[k, v]: block->getProperties<std::string>()) { props[k.c_str()] = v; }
+    /**
+     * @param filename Path to the MAE or GZipped MAE file to scan
+     * @param resynchronize See above
+     */
+    explicit BlockScanner(const std::string &filename, const bool resynchronize = false)
+        : BlockScanner(open_input_stream(filename), resynchronize) {
+    }
+
+    /**
+     * @brief Scans the next top-level block
+     * @return The block, or std::nullopt if the end of the file was reached
+     */
+    std::optional<RawBlock> next() {
+        while (true) {
+            if (m_position == m_size && !fill()) {
+                return finish();
+            }
+
+            const auto c = m_buffer[m_position++];
 
-        if (props.contains(schrodinger::mae::CT_TITLE)) {
-            nb::del(props[schrodinger::mae::CT_TITLE]);
+            if (m_in_comment) {
+                m_in_comment = c != '#';
+                m_text += c;
+            } else if (m_in_quote && !(m_resynchronize && c == '\n')) {
+                m_in_quote = m_in_escape || c != '"';
+                m_in_escape = !m_in_escape && c == '\\';
+                m_text += c;
+            } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+                // quoted strings cannot span lines, so when resynchronizing an unterminated one ends here
+                m_in_quote = false;
+                m_in_escape = false;
+
+                auto block = m_in_token ? end_token() : std::nullopt;
+                m_at_line_start = c == '\n';
+                m_text += c;
+
+                if (block) { return block; }
+            } else if (!m_in_token && c == '#') {
+                m_in_comment = true;
+                m_text += c;
+            } else {
+                if (!m_in_token) {
+                    m_in_token = true;
+                    m_token_quoted = c == '"';
+                    m_in_quote = m_token_quoted;
+                    m_token_at_line_start = m_at_line_start;
+                    m_token_start = m_text.size();
+                }
+                m_at_line_start = false;
+                m_text += c;
+            }
         }
-        structure["props"] = props;
+    }
+
+private:
+    bool fill() {
+        m_offset += m_size;
+        m_position = 0;
+        m_size = 0;
 
-        if (const auto atom_block = block->getIndexedBlock(schrodinger::mae::ATOM_BLOCK)) {
-            nb::dict atoms;
-            process_block_properties(atoms, atom_block);
-            structure["atoms"] = atoms;
+        if (m_stream->good()) {
+            m_stream->read(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+            m_size = static_cast<size_t>(m_stream->gcount());
         }
-        if (const auto bond_block = block->getIndexedBlock(schrodinger::mae::BOND_BLOCK)) {
-            nb::dict bonds;
-            process_block_properties(bonds, bond_block);
-            structure["bonds"] = bonds;
+        if (m_stream->bad()) {
+            throw std::runtime_error("Failed to read from the MAE file");
         }
+        return m_size > 0;
+    }
 
-        structures.push_back(structure);
+    std::string_view token() const { return std::string_view(m_text).substr(m_token_start); }
+
+    /**
+     * @brief Drops any text before the current token, e.g. whitespace between top-level blocks
+     */
+    void discard_before_token() {
+        m_text_offset += m_token_start;
+        m_text.erase(0, m_token_start);
+        m_token_start = 0;
     }
 
-    return structures;
-}
+    RawBlock take_block(const size_t end, const bool complete) {
+        RawBlock block{m_name, m_text_offset, m_text.substr(0, end), complete};
+
+        m_text_offset += end;
+        m_text.erase(0, end);
+        m_token_start -= std::min(m_token_start, end);
+
+        return block;
+    }
+
+    /**
+     * @brief Tracks which section of a block is being scanned
+     */
+    struct Frame {
+        enum class Section { Keys, Values, Blocks };
+
+        bool indexed = false; ///< Whether this is an indexed block, e.g. m_atom[3], whose values are rows
+        Section section = Section::Keys;
+        size_t n_keys = 0;
+        size_t n_values = 0;
+    };
+
+    void open_block(const bool indexed) {
+        if (!m_frames.empty()) { m_frames.back().section = Frame::Section::Blocks; }
+        m_frames.push_back({indexed});
+    }
+
+    /**
+     * @brief Consumes a token of the current block other than one which opens a sub-block
+     * @return Whether the token closes the block
+     */
+    bool block_token(const std::string_view token, const bool quoted) {
+        auto &frame = m_frames.back();
+
+        if (!quoted && token == ":::") {
+            if (frame.section == Frame::Section::Keys && (frame.indexed || frame.n_keys > 0)) {
+                frame.section = Frame::Section::Values;
+            } else {
+                frame.section = Frame::Section::Blocks;
+            }
+        } else if (frame.section == Frame::Section::Values) {
+            if (!frame.indexed && ++frame.n_values == frame.n_keys) { frame.section = Frame::Section::Blocks; }
+        } else if (!quoted && token == "}") {
+            m_frames.pop_back();
+            return true;
+        } else if (frame.section == Frame::Section::Keys) {
+            ++frame.n_keys;
+        }
+        return false;
+    }
+
+    std::optional<RawBlock> end_token() {
+        m_in_token = false;
+
+        const auto token = this->token();
+        const auto previous_indexed = m_token_indexed;
+
+        m_token_indexed = !m_token_quoted && token.find('[') != std::string_view::npos;
+
+        if (m_token_quoted) {
+            if (!m_frames.empty()) { block_token(token, true); }
+            return std::nullopt;
+        }
+
+        const auto in_name_position = m_frames.empty() || m_frames.back().section != Frame::Section::Values;
+        const auto is_name_brace = token.size() > 1 && token.find_first_of("{}\"") == token.size() - 1 &&
+                                   token.back() == '{';
+        const auto opens = in_name_position && (token == "{" || is_name_brace);
+
+        if (m_frames.empty()) {
+            if (!opens) {
+                discard_before_token();
+                m_has_name = true;
+                return std::nullopt;
+            }
+
+            if (!m_has_name || token.size() > 1) {
+                discard_before_token();
+            }
+            m_name = std::string(m_text.substr(0, m_text.find_first_of(" \t\r\n{")));
+            m_has_name = false;
+            open_block(false);
+            return std::nullopt;
+        }
+
+        if (m_resynchronize && m_token_at_line_start &&
+            (token == schrodinger::mae::CT_BLOCK || token == std::string(schrodinger::mae::CT_BLOCK) + "{")) {
+            auto block = take_block(m_token_start, false);
+
+            m_frames.clear();
+            m_has_name = false;
+            m_in_token = true;
+            end_token();
+
+            return block;
+        }
+
+        if (opens) {
+            if (token == "{") {
+                // The preceding token named the block, rather than being a key of the current block
+                auto &frame = m_frames.back();
+                frame.n_keys -= std::min<size_t>(frame.n_keys, frame.section == Frame::Section::Keys);
+
+                open_block(previous_indexed);
+            } else {
+                open_block(m_token_indexed);
+            }
+        } else if (block_token(token, false) && m_frames.empty()) {
+            return take_block(m_text.size(), true);
+        }
+        return std::nullopt;
+    }
+
+    std::optional<RawBlock> finish() {
+        auto block = m_in_token ? end_token() : std::nullopt;
+
+        if (!block && !m_frames.empty()) {
+            m_frames.clear();
+            block = take_block(m_text.size(), false);
+        }
+        return block;
+    }
+
+    std::shared_ptr<std::istream> m_stream;
+    std::vector<char> m_buffer;
+    size_t m_position = 0;
+    size_t m_size = 0;
+    uint64_t m_offset = 0;
+
+    const bool m_resynchronize;
+
+    std::string m_text; ///< The text of the current block, or of the whitespace and tokens preceding it
+    uint64_t m_text_offset = 0; ///< The offset of the start of m_text in the file
+    std::string m_name;
+    bool m_has_name = false; ///< Whether m_text starts with a token which may name the next block
+    std::vector<Frame> m_frames; ///< The blocks which are currently open, outermost first
 
+    bool m_in_comment = false;
+    bool m_in_quote = false;
+    bool m_in_escape = false;
+    bool m_in_token = false;
+    bool m_token_quoted = false;
+    bool m_token_at_line_start = false;
+    bool m_token_indexed = false; ///< Whether the last token could name an indexed block, e.g. m_atom[3]
+    bool m_at_line_start = true;
+    size_t m_token_start = 0;
+};
 
 /**
- * @brief Adds all properties from a Python dictionary to a MAE block
- * @param block The MAE block to add properties to
- * @param props The Python dictionary containing properties
- * @throws std::runtime_error If a property has an unsupported type
+ * @brief Returns the next complete CT block found by a scanner
+ * @throws std::runtime_error If the file ends part way through a CT block
  */
-void add_properties_to_block(const std::shared_ptr<schrodinger::mae::Block> &block, const nb::dict &props) {
-    for (const auto &item: props) {
-        auto key = nb::cast<std::string>(item.first);
-        nb::handle value = item.second;
+std::optional<RawBlock> next_ct_block(BlockScanner &scanner) {
+    while (auto block = scanner.next()) {
+        if (block->name != schrodinger::mae::CT_BLOCK) { continue; }
 
-        if (key.compare(0, 2, "i_") == 0) {
-            block->setIntProperty(key, nb::cast<int>(value));
-        } else if (key.compare(0, 2, "r_") == 0) {
-            block->setRealProperty(key, nb::cast<double>(value));
-        } else if (key.compare(0, 2, "s_") == 0) {
-            block->setStringProperty(key, nb::cast<std::string>(value));
-        } else if (key.compare(0, 2, "b_") == 0) {
-            block->setBoolProperty(key, nb::cast<uint8_t>(value));
-        } else {
-            throw std::runtime_error("Unsupported property type for key: " + key);
+        if (!block->complete) {
+            throw std::runtime_error("The MAE file ends part way through the f_m_ct block starting at byte " +
+                                     std::to_string(block->offset));
         }
+        return block;
     }
+    return std::nullopt;
 }
 
 /**
- * @brief Creates an indexed property in a MAE block from a Python list of values
- * @tparam T The type of property (uint8_t, int, double, or std::string)
- * @param name The name of the property
- * @param values Python list containing the property values
- * @param block_size The size of the block
- * @param block The MAE indexed block to add the property to
+ * @brief Splits the text of an MAE block into whitespace separated tokens, skipping comments
+ * @details Quoted strings are returned as a single token including their quotes, see unquote_mae_string.
  */
-template<typename T>
-void create_indexed_property(
-    const std::string &name,
-    const nb::list &values,
-    const size_t block_size,
-    std::shared_ptr<schrodinger::mae::IndexedBlock> &block
-) {
-    auto m_values = std::vector<T>();
-    m_values.reserve(block_size);
+class MaeTokenizer {
+public:
+    explicit MaeTokenizer(const std::string_view text, const size_t position = 0)
+        : m_text(text), m_position(position) {
+    }
 
-    auto m_is_null = new boost::dynamic_bitset(block_size);
+    /**
+     * @brief Returns the next token as a view into the text, or an empty view at the end of the text
+     */
+    std::string_view next() {
+        const auto is_space = [](const char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; };
 
-    for (size_t i = 0; i < block_size; ++i) {
-        if (values[i].is_none()) {
-            m_is_null->set(i);
-            m_values.push_back(T());
+        while (m_position < m_text.size()) {
+            if (is_space(m_text[m_position])) {
+                ++m_position;
+            } else if (m_text[m_position] == '#') {
+                m_position = std::min(m_text.find('#', m_position + 1), m_text.size() - 1) + 1;
+            } else {
+                break;
+            }
+        }
+
+        const auto start = m_position;
+
+        if (m_position < m_text.size() && m_text[m_position] == '"') {
+            for (++m_position; m_position < m_text.size() && m_text[m_position] != '"'; ++m_position) {
+                if (m_text[m_position] == '\\') { ++m_position; }
+            }
+            m_position = std::min(m_position + 1, m_text.size());
         } else {
-            m_values.push_back(nb::cast<T>(values[i]));
+            while (m_position < m_text.size() && !is_space(m_text[m_position])) { ++m_position; }
         }
+
+        return m_text.substr(start, m_position - start);
     }
 
-    auto property = std::make_shared<schrodinger::mae::IndexedProperty<T> >(m_values, m_is_null);
-    block->setProperty(name, property);
+    /**
+     * @brief The offset just past the last token returned
+     */
+    size_t position() const { return m_position; }
+
+private:
+    std::string_view m_text;
+    size_t m_position;
+};
+
+/**
+ * @brief Converts a string token of an MAE file to its value, removing quotes and escapes
+ */
+std::string unquote_mae_string(const std::string_view token) {
+    if (token.size() < 2 || token.front() != '"') { return std::string(token); }
+
+    std::string value;
+    value.reserve(token.size() - 2);
+
+    for (size_t i = 1; i + 1 < token.size(); ++i) {
+        if (token[i] == '\\' && i + 2 < token.size()) { ++i; }
+        value += token[i];
+    }
+    return value;
 }
 
 /**
- * @brief Adds indexed properties from a Python dictionary to a MAE indexed block
- * @param block The MAE indexed block to add properties to
- * @param props The Python dictionary containing properties
- * @throws std::runtime_error If property lists have inconsistent sizes or if a property has an unsupported type
+ * @brief The CT level properties of a raw f_m_ct block, parsed without parsing its indexed blocks
  */
-void add_indexed_properties_to_block(std::shared_ptr<schrodinger::mae::IndexedBlock> &block,
-                                     const nb::dict &props) {
-    size_t block_size = 0;
+struct CtHeader {
+    std::vector<std::string_view> names; ///< Views into the block text of the property names
+    std::vector<std::string_view> values; ///< Views into the block text of the raw property value tokens
+    size_t begin = 0; ///< The offset just past the opening brace of the block
+    size_t end = 0; ///< The offset just past the last property value
 
-    for (const auto &item: props) {
-        const auto values = nb::cast<nb::list>(item.second);
-        block_size = values.size();
-        break;
+    /**
+     * @brief Returns the raw value token of a property, or std::nullopt if it is not defined
+     */
+    std::optional<std::string_view> find(const std::string_view name) const {
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (names[i] == name) { return values[i]; }
+        }
+        return std::nullopt;
     }
+};
 
-    if (block_size == 0) { return; }
+/**
+ * @brief Parses the CT level property names and values at the start of the text of a raw f_m_ct block
+ * @param text The text of the block, which must outlive the returned header
+ * @return The parsed properties
+ * @throws std::runtime_error If the properties cannot be parsed
+ */
+CtHeader parse_ct_header(const std::string_view text) {
+    const auto parse_error = [] {
+        return std::runtime_error("Could not parse the properties of the f_m_ct block");
+    };
 
-    for (const auto &item: props) {
-        auto key = nb::cast<std::string>(item.first);
-        auto values = nb::cast<nb::list>(item.second);
+    CtHeader header;
 
-        if (values.size() != block_size) {
-            throw std::runtime_error("Inconsistent property list sizes for key: " + key);
-        }
+    const auto brace = text.find('{');
+    if (brace == std::string_view::npos) { throw parse_error(); }
 
-        if (key.compare(0, 2, "i_") == 0) {
-            create_indexed_property<int>(key, values, block_size, block);
-        } else if (key.compare(0, 2, "r_") == 0) {
-            create_indexed_property<double>(key, values, block_size, block);
-        } else if (key.compare(0, 2, "s_") == 0) {
-            create_indexed_property<std::string>(key, values, block_size, block);
-        } else if (key.compare(0, 2, "b_") == 0) {
-            create_indexed_property<uint8_t>(key, values, block_size, block);
-        } else {
-            throw std::runtime_error("Unsupported property type for key: " + key);
+    header.begin = header.end = brace + 1;
+
+    MaeTokenizer tokenizer(text, header.begin);
+
+    while (true) {
+        const auto token = tokenizer.next();
+
+        if (token.empty()) { throw parse_error(); }
+        if (token == ":::") { break; }
+        if (token == "}" || token.back() == '{') {
+            if (!header.names.empty()) { throw parse_error(); }
+            return header;
         }
+        header.names.push_back(token);
     }
+    for (size_t i = 0; i < header.names.size(); ++i) {
+        const auto token = tokenizer.next();
+
+        if (token.empty()) { throw parse_error(); }
+        header.values.push_back(token);
+    }
+
+    header.end = tokenizer.position();
+    return header;
 }
 
 /**
- * @brief Writes structure information to an MAE file
- * @param filename Path to the MAE file to write
- * @param structures List of dictionaries containing structure information:
- *        - title: Structure title (optional)
- *        - props: Dictionary of structure properties (optional)
- *        - atoms: Dictionary of atom properties (optional)
- *        - bonds: Dictionary of bond properties (optional)
+ * @brief Parses a numeric (b_, i_ or r_) property value token
+ * @return The value, or std::nullopt if the token is the undefined value <>
+ * @throws std::runtime_error If the token is not a number
  */
-void write_mae(const std::vector<nb::dict> &structures, const std::string &filename) {
-    schrodinger::mae::Writer writer(filename);
+std::optional<double> parse_mae_number(const std::string_view token) {
+    if (token == "<>") { return std::nullopt; }
 
-    for (const auto &structure: structures) {
-        auto block = std::make_shared<schrodinger::mae::Block>(schrodinger::mae::CT_BLOCK);
-        auto block_map = std::make_shared<schrodinger::mae::IndexedBlockMap>();
+    double value;
+    const auto result = std::from_chars(token.data(), token.data() + token.size(), value);
 
-        if (structure.contains("title")) {
-            const auto title = nb::cast<std::string>(structure["title"]);
-            block->setStringProperty(schrodinger::mae::CT_TITLE, title);
-        }
-        if (structure.contains("props")) {
-            nb::dict props = structure["props"];
-            add_properties_to_block(block, props);
-        }
-        if (structure.contains("atoms")) {
-            auto atom_block = std::make_shared<schrodinger::mae::IndexedBlock>(schrodinger::mae::ATOM_BLOCK);
-            nb::dict atoms = structure["atoms"];
+    if (result.ec != std::errc() || result.ptr != token.data() + token.size()) {
+        throw std::runtime_error("Could not parse '" + std::string(token) + "' as a number");
+    }
+    return value;
+}
 
-            add_indexed_properties_to_block(atom_block, atoms);
-            block_map->addIndexedBlock("m_atom", atom_block);
-        }
-        if (structure.contains("bonds")) {
-            auto bond_block = std::make_shared<schrodinger::mae::IndexedBlock>(schrodinger::mae::BOND_BLOCK);
-            nb::dict bonds = structure["bonds"];
+/**
+ * @brief Moves a vector into a 1D numpy array without copying its values
+ * @tparam T The type of the array values
+ * @tparam V The type of the vector values, which must have the same size as T
+ */
+template<typename T, typename V = T>
+nb::object to_numpy(std::vector<V> &&values) {
+    static_assert(sizeof(T) == sizeof(V));
 
-            add_indexed_properties_to_block(bond_block, bonds);
-            block_map->addIndexedBlock("m_bond", bond_block);
-        }
+    auto *data = new std::vector<V>(std::move(values));
+    nb::capsule owner(data, [](void *p) noexcept { delete static_cast<std::vector<V> *>(p); });
 
-        block->setIndexedBlockMap(block_map);
+    return nb::cast(nb::ndarray<nb::numpy, T, nb::ndim<1> >(data->data(), {data->size()}, owner));
+}
 
-        writer.write(block);
-    }
+/**
+ * @brief Moves a vector of row-major values into a 2D numpy array with a given number of rows without copying
+ */
+template<typename T>
+nb::object to_numpy(std::vector<T> &&values, const size_t n_rows) {
+    auto *data = new std::vector<T>(std::move(values));
+    nb::capsule owner(data, [](void *p) noexcept { delete static_cast<std::vector<T> *>(p); });
+
+    const auto n_columns = n_rows == 0 ? 0 : data->size() / n_rows;
+    return nb::cast(nb::ndarray<nb::numpy, T, nb::ndim<2> >(data->data(), {n_rows, n_columns}, owner));
 }
 
+/**
+ * @brief A read-only 1D numpy array, as accepted from Python
+ */
+template<typename T>
+using NumpyColumn = nb::ndarray<const T, nb::ndim<1>, nb::c_contig, nb::device::cpu>;
 
 /**
- * @brief Python module for reading and writing Maestro MAE files
- * @param m The module object to define functions in
- * @details Provides functionality to read and write MAE files and extract structure information
- *          including atoms, bonds, and global properties
+ * @brief Unpacks the first n bits of a bitmap into a numpy bool array
  */
-NB_MODULE(pymaeparser_ext, m) {
-    m.def("read_mae", &read_mae, "Read an MAE file and return atoms/bonds info");
+nb::object bitmap_to_numpy(const uint8_t *bytes, const size_t n_bits, const size_t n) {
+    std::vector<uint8_t> values(n);
+    for (size_t i = 0; i < n && i < n_bits; ++i) { values[i] = bytes[i >> 3] >> (i & 7) & 1; }
+
+    return to_numpy<bool>(std::move(values));
+}
+
+/**
+ * @brief How b_ columns of atoms and bonds are converted to Python objects
+ */
+enum class BoolFormat {
+    List, ///< A list of bools, with None for undefined values
+    Numpy, ///< A tuple of a numpy bool array of the values and a numpy bool mask of the undefined values (or None)
+    Packed ///< A PackedBits of the values and undefined values
+};
+
+/**
+ * @brief How the columns of atoms and bonds are converted to Python objects
+ */
+enum class ColumnFormat {
+    List, ///< A list of values, with None for undefined values
+    Numpy ///< A tuple of a dense numpy array of the values (a list for s_ columns), with an arbitrary value wherever
+          ///< undefined, and a numpy bool mask of the undefined values (or None). b_ columns use BoolFormat::Numpy
+          ///< unless BoolFormat::Packed is requested
+};
+
+/**
+ * @brief Options controlling how parsed CT blocks are converted to Python objects
+ */
+struct ConvertOptions {
+    bool lazy = false; ///< Whether to return Structure objects rather than dictionaries
+    BoolFormat bools = BoolFormat::List; ///< How b_ columns of atoms and bonds are converted
+    ColumnFormat columns = ColumnFormat::List; ///< How other columns of atoms and bonds are converted
+
+    /**
+     * @brief Whether every column is converted to a list, as by convert_binary
+     */
+    bool lists() const { return bools == BoolFormat::List && columns == ColumnFormat::List; }
+};
+
+/**
+ * @brief A column of bools packed eight to a byte in little-endian bit order, i.e. the layout produced by
+ *        numpy.packbits(..., bitorder="little"), with the undefined values optionally packed in the same way
+ * @details Large systems can have millions of atoms, so storing b_ columns in this form takes 1/8 of the memory
+ *          of a numpy bool array and 1/64 of a list of bools. Columns in this form can be written without
+ *          converting each value to a Python object.
+ */
+class PackedBits {
+public:
+    using Array = nb::ndarray<nb::numpy, const uint8_t, nb::ndim<1>, nb::c_contig, nb::device::cpu>;
+
+    /**
+     * @param bits The packed values, as a 1D uint8 array
+     * @param size The number of values
+     * @param nulls The packed undefined values, as a 1D uint8 array, or None if all values are defined
+     * @throws std::invalid_argument If either array has fewer than (size + 7) / 8 bytes
+     * @details Arrays of another type or layout are converted once here, and the converted arrays are kept.
+     */
+    PackedBits(const nb::handle &bits, const size_t size, const nb::handle &nulls)
+        : m_bits(nb::cast<Array>(bits)), m_size(size) {
+        if (!nulls.is_none()) { m_nulls = nb::cast<Array>(nulls); }
+
+        const auto n_bytes = (m_size + 7) / 8;
+
+        if (m_bits.shape(0) < n_bytes || (m_nulls && m_nulls->shape(0) < n_bytes)) {
+            throw std::invalid_argument("The packed arrays must have at least (size + 7) // 8 bytes");
+        }
+    }
+
+    /**
+     * @brief Packs the values and undefined values of an indexed property
+     */
+    static PackedBits pack(const schrodinger::mae::IndexedProperty<uint8_t> &property, const size_t size) {
+        const auto &data = property.data();
+        const auto *is_null = property.nullIndices();
+
+        std::vector<uint8_t> bits((size + 7) / 8, 0);
+        for (size_t i = 0; i < size && i < data.size(); ++i) {
+            bits[i >> 3] |= static_cast<uint8_t>((data[i] != 0) << (i & 7));
+        }
+
+        nb::object nulls = nb::none();
+
+        if (is_null && is_null->any()) {
+            std::vector<uint8_t> null_bits((size + 7) / 8, 0);
+            for (auto i = is_null->find_first(); i < size; i = is_null->find_next(i)) {
+                null_bits[i >> 3] |= static_cast<uint8_t>(1u << (i & 7));
+            }
+            nulls = to_numpy<uint8_t>(std::move(null_bits));
+        }
+
+        return {to_numpy<uint8_t>(std::move(bits)), size, nulls};
+    }
+
+    nb::object bits() const { return nb::cast(m_bits); }
+
+    nb::object nulls() const { return m_nulls ? nb::cast(*m_nulls) : nb::none(); }
+
+    size_t size() const { return m_size; }
+
+    /**
+     * @brief Unpacks the values and undefined values into numpy bool arrays
+     * @return The values, and the undefined values or None if all values are defined
+     */
+    std::pair<nb::object, nb::object> unpack() const {
+        return {
+            bitmap_to_numpy(data(m_bits), m_size, m_size),
+            m_nulls ? bitmap_to_numpy(data(*m_nulls), m_size, m_size) : nb::none()
+        };
+    }
+
+    /**
+     * @brief Creates an indexed property from the packed values
+     */
+    std::shared_ptr<schrodinger::mae::IndexedProperty<uint8_t> > to_property() const {
+        const auto *bits = data(m_bits);
+
+        std::vector<uint8_t> values(m_size);
+        for (size_t i = 0; i < m_size; ++i) { values[i] = bits[i >> 3] >> (i & 7) & 1; }
+
+        boost::dynamic_bitset<> *is_null = nullptr;
+
+        if (m_nulls) {
+            const auto *null_bits = data(*m_nulls);
+            is_null = new boost::dynamic_bitset<>(m_size);
+
+            for (size_t i = 0; i < m_size; i += 8) {
+                if (null_bits[i >> 3] == 0) { continue; }
+
+                for (auto j = i; j < std::min(i + 8, m_size); ++j) {
+                    if (null_bits[j >> 3] >> (j & 7) & 1) { is_null->set(j); }
+                }
+            }
+        }
+
+        return std::make_shared<schrodinger::mae::IndexedProperty<uint8_t> >(values, is_null);
+    }
+
+private:
+    static const uint8_t *data(const Array &array) { return static_cast<const uint8_t *>(array.data()); }
+
+    Array m_bits;
+    std::optional<Array> m_nulls;
+    size_t m_size;
+};
+
+/**
+ * @brief Converts the undefined values of an indexed property to a numpy bool mask
+ * @return The mask, or None if all values are defined
+ */
+template<typename T>
+nb::object convert_null_mask(const schrodinger::mae::IndexedProperty<T> &property, const size_t block_size) {
+    const auto *is_null = property.nullIndices();
+
+    if (!is_null || is_null->none()) { return nb::none(); }
+
+    std::vector<uint8_t> mask(block_size, 0);
+    for (auto i = is_null->find_first(); i < block_size; i = is_null->find_next(i)) { mask[i] = 1; }
+
+    return to_numpy<bool>(std::move(mask));
+}
+
+/**
+ * @brief Returns the number of values in a column of an indexed block, which is either a list, a PackedBits or,
+ *        for b_ columns, a numpy bool array or a tuple of a numpy bool array and a mask of undefined values
+ */
+size_t indexed_column_size(const nb::handle &column) {
+    if (nb::isinstance<PackedBits>(column)) { return nb::cast<const PackedBits &>(column).size(); }
+    if (nb::isinstance<nb::tuple>(column)) { return nb::len(nb::cast<nb::tuple>(column)[0]); }
+
+    return nb::len(column);
+}
+
+/**
+ * @brief Converts an indexed property list to a Python list
+ * @tparam T The type of property (uint8_t, int, double, or std::string)
+ * @param props The indexed property to convert
+ * @param block_size The size of the block containing the properties
+ * @return A Python list containing the property values, with None for undefined values
+ */
+template<typename T>
+nb::list convert_indexed_properties(const std::shared_ptr<schrodinger::mae::IndexedProperty<T> > &props,
+                                    const size_t block_size) {
+    nb::list result;
+    for (size_t i = 0; i < block_size; ++i) {
+        if (props->isDefined(i)) {
+            auto value = props->at(i);
+
+            if constexpr (std::is_same_v<T, uint8_t>) {
+                result.append(static_cast<bool>(value));
+            } else {
+                result.append(value);
+            }
+        } else {
+            result.append(nb::none());
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Converts the values of an indexed property to a dense numpy array (or a list for std::string), including
+ *        whatever placeholder values the undefined values have
+ */
+template<typename T>
+nb::object convert_dense_values(const schrodinger::mae::IndexedProperty<T> &property, const size_t block_size) {
+    const auto &data = property.data();
+    const auto n_values = std::min(block_size, data.size());
+
+    if constexpr (std::is_same_v<T, std::string>) {
+        nb::list values;
+        for (size_t i = 0; i < block_size; ++i) { values.append(i < n_values ? data[i] : std::string()); }
+
+        return values;
+    } else {
+        std::vector<T> values(block_size, T());
+
+        if constexpr (std::is_same_v<T, uint8_t>) {
+            std::transform(data.begin(), data.begin() + n_values, values.begin(), [](const T v) { return v != 0; });
+            return to_numpy<bool>(std::move(values));
+        } else {
+            std::copy(data.begin(), data.begin() + n_values, values.begin());
+            return to_numpy<std::conditional_t<std::is_same_v<T, int>, int32_t, T> >(std::move(values));
+        }
+    }
+}
+
+/**
+ * @brief Converts an indexed property to a Python object in the format requested by the conversion options
+ * @return A list (see convert_indexed_properties), a tuple of a dense array and a null mask (see ColumnFormat),
+ *         or for b_ properties a PackedBits if requested (see BoolFormat)
+ */
+template<typename T>
+nb::object convert_indexed_column(const std::shared_ptr<schrodinger::mae::IndexedProperty<T> > &props,
+                                  const size_t block_size,
+                                  const ConvertOptions &options) {
+    bool dense = options.columns == ColumnFormat::Numpy;
+
+    if constexpr (std::is_same_v<T, uint8_t>) {
+        if (options.bools == BoolFormat::Packed) { return nb::cast(PackedBits::pack(*props, block_size)); }
+
+        dense = dense || options.bools == BoolFormat::Numpy;
+    }
+
+    if (dense) {
+        return nb::make_tuple(convert_dense_values(*props, block_size), convert_null_mask(*props, block_size));
+    }
+    return convert_indexed_properties(props, block_size);
+}
+
+/**
+ * @brief The property names of a block in conversion order, with a Python key for each
+ * @details Consecutive structures usually have identical columns, e.g. millions of docked poses of a ligand, so
+ *          the schema of the previous block is reused when the names match rather than creating new key strings
+ *          for every property of every structure. Only the names are compared, as the property maps of each block
+ *          still determine how each value is converted.
+ */
+class BlockSchema {
+public:
+    /**
+     * @brief Updates the schema to match the properties of a block
+     * @param maps The bool, int, real and string property maps of the block, in conversion order
+     */
+    template<typename... Maps>
+    void update(const Maps &...maps) {
+        size_t column = 0;
+
+        if ((matches(maps, column) && ...) && column == m_names.size()) { return; }
+
+        m_names.clear();
+        m_keys.clear();
+
+        (add(maps), ...);
+    }
+
+    nb::handle key(const size_t column) const { return m_keys[column]; }
+
+private:
+    template<typename Map>
+    bool matches(const Map &map, size_t &column) const {
+        for (const auto &entry: map) {
+            if (column >= m_names.size() || m_names[column] != entry.first) { return false; }
+            ++column;
+        }
+        return true;
+    }
+
+    template<typename Map>
+    void add(const Map &map) {
+        for (const auto &entry: map) {
+            auto *key = PyUnicode_FromStringAndSize(entry.first.data(), static_cast<Py_ssize_t>(entry.first.size()));
+            if (!key) { throw nb::python_error(); }
+
+            m_names.push_back(entry.first);
+            m_keys.push_back(nb::steal(key));
+        }
+    }
+
+    std::vector<std::string> m_names;
+    std::vector<nb::object> m_keys;
+};
+
+/**
+ * @brief The schemas of the CT properties, atoms and bonds of the last structure converted (see convert_block)
+ * @details Each thread converting structures must use its own schemas, which hold Python objects and so must be
+ *          destroyed while the thread is attached to the interpreter.
+ */
+struct StructureSchema {
+    BlockSchema props;
+    BlockSchema atoms;
+    BlockSchema bonds;
+};
+
+/**
+ * @brief Adds all properties of a given type to a Python dictionary
+ * @tparam T The type of properties to add (uint8_t, int, double, or std::string)
+ * @param dict The Python dictionary to add properties to
+ * @param props Map of property names to property values
+ * @param block_size The size of the block containing the properties
+ * @param schema The schema of the block, which was updated to match it
+ * @param column The index of the first property in the schema, which is advanced past the properties
+ * @param options How the properties are converted
+ */
+template<typename T>
+void add_properties_to_dict(nb::dict &dict,
+                            const std::map<std::string, std::shared_ptr<schrodinger::mae::IndexedProperty<T> > > &props,
+                            size_t block_size,
+                            const BlockSchema &schema,
+                            size_t &column,
+                            const ConvertOptions &options) {
+    for (const auto &entry: props) {
+        dict[schema.key(column++)] = convert_indexed_column(entry.second, block_size, options);
+    }
+}
+
+/**
+ * @brief Processes all property types for a block and adds them to a Python dictionary
+ * @param dict The Python dictionary to add properties to
+ * @param block The indexed block containing the properties
+ * @param schema The schema of the previous block of the same kind, which is updated to match this block
+ * @param options How the properties are converted
+ */
+void process_block_properties(nb::dict &dict,
+                              const std::shared_ptr<const schrodinger::mae::IndexedBlock> &block,
+                              BlockSchema &schema,
+                              const ConvertOptions &options) {
+    const auto &bools = block->getProperties<uint8_t>();
+    const auto &ints = block->getProperties<int>();
+    const auto &reals = block->getProperties<double>();
+    const auto &strings = block->getProperties<std::string>();
+
+    schema.update(bools, ints, reals, strings);
+
+    size_t column = 0;
+    add_properties_to_dict(dict, bools, block->size(), schema, column, options);
+    add_properties_to_dict(dict, ints, block->size(), schema, column, options);
+    add_properties_to_dict(dict, reals, block->size(), schema, column, options);
+    add_properties_to_dict(dict, strings, block->size(), schema, column, options);
+}
+
+/**
+ * @brief Converts the CT level properties of a CT block, other than its title, to a Python dictionary
+ * @param block The CT block
+ * @param schema The schema of the CT properties of the previous block, which is updated to match this block
+ */
+nb::dict convert_ct_properties(const schrodinger::mae::Block &block, BlockSchema &schema) {
+    const auto &bools = block.getProperties<uint8_t>();
+    const auto &ints = block.getProperties<int>();
+    const auto &reals = block.getProperties<double>();
+    const auto &strings = block.getProperties<std::string>();
+
+    schema.update(bools, ints, reals, strings);
+
+    nb::dict props;
+    size_t column = 0;
+
+    for (const auto &[k, v]: bools) { props[schema.key(column++)] = bool(v); }
+    for (const auto &[k, v]: ints) { props[schema.key(column++)] = v; }
+    for (const auto &[k, v]: reals) { props[schema.key(column++)] = v; }
+    for (const auto &[k, v]: strings) { props[schema.key(column++)] = v; }
+
+    if (props.contains(schrodinger::mae::CT_TITLE)) {
+        nb::del(props[schrodinger::mae::CT_TITLE]);
+    }
+    return props;
+}
+
+/**
+ * @brief Converts an indexed block of a CT block to a Python dictionary of property lists
+ * @param schema The schema of the same indexed block of the previous CT block, which is updated to match
+ * @param options How the properties are converted
+ * @return The converted properties, or std::nullopt if the CT block has no such indexed block
+ */
+std::optional<nb::dict> convert_indexed_block(const schrodinger::mae::Block &block,
+                                              const std::string &name,
+                                              BlockSchema &schema,
+                                              const ConvertOptions &options) {
+    const auto indexed_block = get_indexed_block(block, name);
+
+    if (!indexed_block) { return std::nullopt; }
+
+    nb::dict dict;
+    process_block_properties(dict, indexed_block, schema, options);
+    return dict;
+}
+
+/**
+ * @brief Converts a CT block to a Python dictionary
+ * @param block The CT block to convert
+ * @param schema The schemas of the previous structure converted, which are updated to match this one
+ * @param options How the properties of atoms and bonds are converted
+ * @return A Python dictionary containing information about the structure:
+ *         - title: Structure title (if present)
+ *         - props: Dictionary of structure properties
+ *         - atoms: Dictionary of atom properties (if present)
+ *         - bonds: Dictionary of bond properties (if present)
+ */
+nb::dict convert_block(const schrodinger::mae::Block &block,
+                       StructureSchema &schema,
+                       const ConvertOptions &options = {}) {
+    nb::dict structure;
+
+    if (block.hasStringProperty(schrodinger::mae::CT_TITLE)) {
+        structure["title"] = block.getStringProperty(schrodinger::mae::CT_TITLE);
+    }
+    structure["props"] = convert_ct_properties(block, schema.props);
+
+    if (auto atoms = convert_indexed_block(block, schrodinger::mae::ATOM_BLOCK, schema.atoms, options)) {
+        structure["atoms"] = *atoms;
+    }
+    if (auto bonds = convert_indexed_block(block, schrodinger::mae::BOND_BLOCK, schema.bonds, options)) {
+        structure["bonds"] = *bonds;
+    }
+
+    return structure;
+}
+
+/**
+ * @brief Parses the raw text of an f_m_ct block, as returned by BlockScanner
+ * @throws std::runtime_error If the text is not a valid f_m_ct block
+ */
+std::shared_ptr<schrodinger::mae::Block> parse_raw_block(std::string text) {
+    schrodinger::mae::Reader reader(std::make_shared<std::istringstream>(std::move(text)));
+    auto block = reader.next(schrodinger::mae::CT_BLOCK);
+
+    if (!block) {
+        throw std::runtime_error("Could not parse the f_m_ct block");
+    }
+    return block;
+}
+
+std::shared_ptr<schrodinger::mae::Block> create_block(const nb::dict &structure);
+
+/**
+ * @brief A structure read from an MAE file which converts its data to Python objects on first access
+ * @details Structures behave like the dictionaries returned by convert_block with all of the title, props, atoms
+ *          and bonds keys present. Each entry is converted from the parsed CT block the first time it is accessed
+ *          and then cached, so reading only the titles or properties of structures never converts their atoms.
+ */
+class Structure {
+public:
+    static constexpr const char *KEYS[] = {"title", "props", "atoms", "bonds"};
+
+    /**
+     * @param block The parsed CT block
+     * @param options How the properties of atoms and bonds are converted when first accessed
+     */
+    explicit Structure(std::shared_ptr<schrodinger::mae::Block> block, const ConvertOptions &options = {})
+        : m_block(std::move(block)), m_options(options) {
+    }
+
+    /**
+     * @brief Wraps a structure that has already been converted (see convert_block)
+     */
+    explicit Structure(const nb::dict &structure) {
+        m_title = structure.contains("title") ? nb::cast<nb::object>(structure["title"]) : nb::none();
+        m_props = structure.contains("props") ? nb::cast<nb::dict>(structure["props"]) : nb::dict();
+        m_atoms = structure.contains("atoms") ? nb::cast<nb::dict>(structure["atoms"]) : nb::dict();
+        m_bonds = structure.contains("bonds") ? nb::cast<nb::dict>(structure["bonds"]) : nb::dict();
+    }
+
+    nb::object title() {
+        if (!m_title) {
+            m_title = m_block->hasStringProperty(schrodinger::mae::CT_TITLE)
+                          ? nb::cast(m_block->getStringProperty(schrodinger::mae::CT_TITLE))
+                          : nb::none();
+        }
+        return *m_title;
+    }
+
+    nb::dict props() {
+        if (!m_props) {
+            BlockSchema schema;
+            m_props = convert_ct_properties(*m_block, schema);
+        }
+        return *m_props;
+    }
+
+    nb::dict atoms() {
+        if (!m_atoms) {
+            BlockSchema schema;
+            m_atoms = convert_indexed_block(*m_block, schrodinger::mae::ATOM_BLOCK, schema, m_options).value_or(nb::dict());
+        }
+        return *m_atoms;
+    }
+
+    nb::dict bonds() {
+        if (!m_bonds) {
+            BlockSchema schema;
+            m_bonds = convert_indexed_block(*m_block, schrodinger::mae::BOND_BLOCK, schema, m_options).value_or(nb::dict());
+        }
+        return *m_bonds;
+    }
+
+    nb::object get(const std::string &key) {
+        if (key == "title") { return title(); }
+        if (key == "props") { return props(); }
+        if (key == "atoms") { return atoms(); }
+        if (key == "bonds") { return bonds(); }
+
+        throw nb::key_error(key.c_str());
+    }
+
+    void set(const std::string &key, const nb::object &value) {
+        if (key == "title") {
+            m_title = value;
+        } else if (key == "props") {
+            m_props = nb::cast<nb::dict>(value);
+        } else if (key == "atoms") {
+            m_atoms = nb::cast<nb::dict>(value);
+        } else if (key == "bonds") {
+            m_bonds = nb::cast<nb::dict>(value);
+        } else {
+            throw nb::key_error(key.c_str());
+        }
+        m_modified = true;
+    }
+
+    static bool contains(const std::string &key) {
+        return std::any_of(std::begin(KEYS), std::end(KEYS), [&key](const char *k) { return key == k; });
+    }
+
+    /**
+     * @brief Converts the whole structure to a dictionary in the format returned by read_mae
+     */
+    nb::dict to_dict() {
+        nb::dict structure;
+        for (const auto *key: KEYS) { structure[key] = get(key); }
+        return structure;
+    }
+
+    /**
+     * @brief Returns a CT block of the structure for writing
+     * @details The parsed CT block is reused as-is if no mutable entry has been converted or replaced, as it
+     *          cannot have been modified. Otherwise a new block is created from the converted entries.
+     */
+    std::shared_ptr<schrodinger::mae::Block> block() {
+        if (m_block && !m_modified && !m_props && !m_atoms && !m_bonds) { return m_block; }
+        return create_block(to_dict());
+    }
+
+private:
+    std::shared_ptr<schrodinger::mae::Block> m_block;
+    ConvertOptions m_options;
+
+    std::optional<nb::object> m_title;
+    std::optional<nb::dict> m_props, m_atoms, m_bonds;
+
+    bool m_modified = false;
+};
+
+/**
+ * @brief A streaming 64-bit (or 128-bit) hash of arbitrary bytes
+ * @details Bytes are consumed eight at a time and folded into the state using a multiply-xorshift mix. A second,
+ *          independently mixed state provides the upper 64 bits of digest128. Hashes are stable between runs, but
+ *          depend on the native byte order.
+ */
+class Hasher {
+public:
+    explicit Hasher(const uint64_t seed = 0) : m_state(seed ^ 0x9e3779b97f4a7c15ULL) {
+    }
+
+    void update(const void *data, size_t size) {
+        auto bytes = static_cast<const uint8_t *>(data);
+        m_length += size;
+
+        if (m_tail_size > 0) {
+            const auto n = std::min(size, sizeof(m_tail) - m_tail_size);
+            std::memcpy(m_tail + m_tail_size, bytes, n);
+
+            m_tail_size += n;
+            bytes += n;
+            size -= n;
+
+            if (m_tail_size < sizeof(m_tail)) { return; }
+
+            consume(m_tail);
+            m_tail_size = 0;
+        }
+        for (; size >= sizeof(m_tail); size -= sizeof(m_tail), bytes += sizeof(m_tail)) {
+            consume(bytes);
+        }
+        std::memcpy(m_tail, bytes, size);
+        m_tail_size = size;
+    }
+
+    template<typename T>
+    void update(const T &value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        update(&value, sizeof(T));
+    }
+
+    void update(const std::string &value) {
+        update<uint64_t>(value.size());
+        update(value.data(), value.size());
+    }
+
+    uint64_t digest() const {
+        uint64_t word = 0;
+        std::memcpy(&word, m_tail, m_tail_size);
+        return mix(m_state ^ mix(word ^ m_length));
+    }
+
+    /**
+     * @brief Returns a 128-bit digest, whose first 8 bytes are the same as digest(), as 16 bytes
+     */
+    std::string digest128() const {
+        uint64_t word = 0;
+        std::memcpy(&word, m_tail, m_tail_size);
+
+        const uint64_t words[2] = {digest(), mix(m_state2 ^ mix(word ^ m_length ^ 0xc2b2ae3d27d4eb4fULL))};
+        return {reinterpret_cast<const char *>(words), sizeof(words)};
+    }
+
+private:
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    void consume(const uint8_t *bytes) {
+        uint64_t word;
+        std::memcpy(&word, bytes, sizeof(word));
+
+        m_state = (m_state ^ mix(word)) * 0x9e3779b97f4a7c15ULL;
+        m_state = (m_state << 31) | (m_state >> 33);
+
+        m_state2 = (m_state2 ^ mix(word ^ 0x6a09e667f3bcc909ULL)) * 0xff51afd7ed558ccdULL;
+        m_state2 = (m_state2 << 27) | (m_state2 >> 37);
+    }
+
+    uint64_t m_state;
+    uint64_t m_state2 = 0x243f6a8885a308d3ULL;
+    uint64_t m_length = 0;
+
+    uint8_t m_tail[8] = {};
+    size_t m_tail_size = 0;
+};
+
+/**
+ * @brief A growable bitmap stored as bytes in little-endian bit order, i.e. the layout produced by
+ *        numpy.packbits(..., bitorder="little")
+ */
+class Bitmap {
+public:
+    size_t size() const { return m_size; }
+
+    bool any() const { return m_any; }
+
+    const std::vector<uint8_t> &bytes() const { return m_bytes; }
+
+    bool test(const size_t i) const { return m_bytes[i >> 3] >> (i & 7) & 1; }
+
+    void set(const size_t i) {
+        if (i >= m_size) { resize(i + 1); }
+
+        m_bytes[i >> 3] |= static_cast<uint8_t>(1u << (i & 7));
+        m_any = true;
+    }
+
+    void push_back(const bool value) {
+        resize(m_size + 1);
+        if (value) { set(m_size - 1); }
+    }
+
+    /**
+     * @brief Grows the bitmap to a given size, setting any new bits to value. The bitmap is never shrunk.
+     */
+    void resize(const size_t size, const bool value = false) {
+        if (size <= m_size) { return; }
+
+        const auto old_size = m_size;
+
+        m_bytes.resize((size + 7) / 8, 0);
+        m_size = size;
+
+        if (value) {
+            for (auto i = old_size; i < m_size; ++i) { set(i); }
+        }
+    }
+
+private:
+    std::vector<uint8_t> m_bytes;
+    size_t m_size = 0;
+    bool m_any = false;
+};
+
+/**
+ * @brief A column of values of one property gathered across many structures
+ * @tparam T The type of property (uint8_t, int, double, or std::string)
+ */
+template<typename T>
+struct ColumnBuilder {
+    std::vector<T> values;
+    Bitmap nulls; ///< One bit per row, set if the value is undefined
+    Bitmap present; ///< One bit per structure, set if the structure defines the property
+
+    void resize(const size_t n_rows) {
+        values.resize(std::max(n_rows, values.size()));
+        nulls.resize(n_rows, true);
+    }
+};
+
+/**
+ * @brief A table of properties gathered across many structures, stored column-wise with the rows of each
+ *        structure stored contiguously, i.e. in a CSR like layout
+ */
+struct ColumnarTable {
+    size_t n_rows = 0;
+    std::vector<uint64_t> offsets{0}; ///< The first row of each structure, followed by n_rows
+    Bitmap present; ///< One bit per structure, set if the structure contains the table
+
+    std::map<std::string, ColumnBuilder<uint8_t> > bools;
+    std::map<std::string, ColumnBuilder<int> > ints;
+    std::map<std::string, ColumnBuilder<double> > reals;
+    std::map<std::string, ColumnBuilder<std::string> > strings;
+
+    template<typename T>
+    auto &columns() {
+        if constexpr (std::is_same_v<T, uint8_t>) {
+            return bools;
+        } else if constexpr (std::is_same_v<T, int>) {
+            return ints;
+        } else if constexpr (std::is_same_v<T, double>) {
+            return reals;
+        } else {
+            return strings;
+        }
+    }
+
+    template<typename T>
+    const auto &columns() const { return const_cast<ColumnarTable *>(this)->columns<T>(); }
+
+    size_t n_structures() const { return offsets.size() - 1; }
+
+    /**
+     * @brief Appends the properties of an indexed block as the rows of the next structure
+     * @param block The indexed block, or nullptr if the structure does not contain one
+     */
+    void append(const schrodinger::mae::IndexedBlock *block) {
+        if (block) {
+            present.set(n_structures());
+
+            append_columns(block->getProperties<uint8_t>(), block->size());
+            append_columns(block->getProperties<int>(), block->size());
+            append_columns(block->getProperties<double>(), block->size());
+            append_columns(block->getProperties<std::string>(), block->size());
+
+            n_rows += block->size();
+        }
+        offsets.push_back(n_rows);
+    }
+
+    /**
+     * @brief Appends the properties of a CT block as a single row
+     * @param block The CT block
+     */
+    void append(const schrodinger::mae::Block &block) {
+        present.set(n_structures());
+
+        append_properties(block.getProperties<uint8_t>());
+        append_properties(block.getProperties<int>());
+        append_properties(block.getProperties<double>());
+        append_properties(block.getProperties<std::string>());
+
+        offsets.push_back(++n_rows);
+    }
+
+    /**
+     * @brief Pads every column with undefined values so that all columns span every row and structure
+     */
+    void finish() {
+        present.resize(n_structures());
+
+        finish_columns(bools);
+        finish_columns(ints);
+        finish_columns(reals);
+        finish_columns(strings);
+    }
+
+private:
+    template<typename T>
+    void append_columns(const std::map<std::string, std::shared_ptr<schrodinger::mae::IndexedProperty<T> > > &props,
+                        const size_t size) {
+        for (const auto &[key, property]: props) {
+            auto &column = columns<T>()[key];
+            column.resize(n_rows);
+            column.present.set(n_structures());
+
+            for (size_t i = 0; i < size; ++i) {
+                const auto defined = property->isDefined(i);
+
+                column.values.push_back(defined ? property->at(i) : T());
+                column.nulls.push_back(!defined);
+            }
+        }
+    }
+
+    template<typename T>
+    void append_properties(const std::map<std::string, T> &props) {
+        for (const auto &[key, value]: props) {
+            auto &column = columns<T>()[key];
+            column.resize(n_rows);
+            column.present.set(n_structures());
+
+            column.values.push_back(value);
+            column.nulls.push_back(false);
+        }
+    }
+
+    template<typename T>
+    void finish_columns(std::map<std::string, ColumnBuilder<T> > &table_columns) {
+        for (auto &[key, column]: table_columns) {
+            column.resize(n_rows);
+            column.present.resize(n_structures());
+        }
+    }
+};
+
+/**
+ * @brief The CT, atom and bond properties of many structures stored as columnar tables
+ */
+struct ColumnarDataset {
+    ColumnarTable props;
+    ColumnarTable atoms;
+    ColumnarTable bonds;
+
+    size_t n_structures() const { return props.n_structures(); }
+
+    void append(const schrodinger::mae::Block &block) {
+        props.append(block);
+        atoms.append(get_indexed_block(block, schrodinger::mae::ATOM_BLOCK).get());
+        bonds.append(get_indexed_block(block, schrodinger::mae::BOND_BLOCK).get());
+    }
+
+    void finish() {
+        props.finish();
+        atoms.finish();
+        bonds.finish();
+    }
+};
+
+/**
+ * @brief The type of the values stored in a column of a binary MAE file
+ */
+enum class ColumnType : uint64_t { Bool = 0, Int = 1, Real = 2, String = 3 };
+
+/**
+ * @brief A selection of structures by index, following the semantics of Python slices with non-negative indices
+ */
+struct Slice {
+    uint64_t start = 0;
+    uint64_t stop = std::numeric_limits<uint64_t>::max();
+    uint64_t step = 1;
+
+    bool is_full() const { return start == 0 && step == 1 && stop == std::numeric_limits<uint64_t>::max(); }
+
+    bool contains(const uint64_t i) const { return i >= start && i < stop && (i - start) % step == 0; }
+};
+
+/**
+ * @brief The size, modification time and a hash of a file, used to detect when a derived file is stale
+ */
+struct SourceFingerprint {
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+
+    bool operator==(const SourceFingerprint &other) const {
+        return size == other.size && mtime == other.mtime && hash == other.hash;
+    }
+};
+
+/**
+ * @brief Fingerprints a file using its size, modification time and a hash of its first and last MiB
+ * @details Only the ends of the file are hashed so that validating a cache of a multi-GB file stays cheap.
+ * @param filename The path to the file
+ * @return The fingerprint of the file
+ */
+SourceFingerprint fingerprint_file(const std::string &filename) {
+    constexpr size_t sample_size = 1 << 20;
+
+    const auto size = std::filesystem::file_size(filename);
+    const auto mtime = std::filesystem::last_write_time(filename).time_since_epoch().count();
+
+    Hasher hasher;
+    hasher.update<uint64_t>(size);
+
+    std::ifstream file(filename, std::ios_base::in | std::ios_base::binary);
+    std::string buffer(std::min<uint64_t>(size, sample_size), '\0');
+
+    file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    hasher.update(buffer.data(), buffer.size());
+
+    if (size > sample_size) {
+        file.seekg(static_cast<std::streamoff>(size - std::min<uint64_t>(size - sample_size, sample_size)));
+        file.read(buffer.data(), static_cast<std::streamsize>(std::min<uint64_t>(size - sample_size, sample_size)));
+        hasher.update(buffer.data(), static_cast<size_t>(file.gcount()));
+    }
+    if (!file) {
+        throw std::runtime_error("Could not read file: " + filename);
+    }
+
+    return {size, static_cast<int64_t>(mtime), hasher.digest()};
+}
+
+/**
+ * @brief The layout of a binary columnar MAE file (.maebin)
+ * @details A binary MAE file starts with a BinaryHeader, followed by 8-byte aligned sections which are
+ *          referenced by their offset from the start of the file. Each of the CT property, atom and bond tables
+ *          is described by a BinaryTable, and each of its columns by a BinaryColumn. Values are stored in the
+ *          native byte order as uint8 (bool), int32, float64 or, for strings, n_rows + 1 uint64 offsets into
+ *          a block of UTF-8 bytes. Bitmaps are stored in little-endian bit order.
+ */
+namespace binary {
+constexpr char MAGIC[8] = {'M', 'A', 'E', 'B', 'I', 'N', '\0', '\0'};
+constexpr uint32_t VERSION = 1;
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct BinaryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    SourceFingerprint source;
+    uint64_t n_structures;
+    uint64_t tables[3]; ///< The offsets of the CT property, atom and bond tables
+};
+
+struct BinaryTable {
+    uint64_t n_rows;
+    uint64_t n_columns;
+    uint64_t offsets; ///< n_structures + 1 uint64 row offsets
+    uint64_t present; ///< Bitmap of the structures which contain the table
+    uint64_t columns; ///< n_columns BinaryColumn
+};
+
+struct BinaryColumn {
+    uint64_t name;
+    uint64_t name_size;
+    ColumnType type;
+    uint64_t present; ///< Bitmap of the structures which define the property
+    uint64_t nulls; ///< Bitmap of the undefined rows, or zero if every row is defined
+    uint64_t values;
+    uint64_t strings; ///< The string bytes referenced by the values of a string column
+};
+
+static_assert(sizeof(int) == sizeof(int32_t));
+static_assert(sizeof(BinaryHeader) % 8 == 0 && sizeof(BinaryTable) % 8 == 0 && sizeof(BinaryColumn) % 8 == 0);
+
+/**
+ * @brief Builds the contents of a binary MAE file in memory
+ */
+class BinaryWriter {
+public:
+    /**
+     * @brief Appends a section, aligned to 8 bytes
+     * @return The offset of the section
+     */
+    uint64_t append(const void *data, const size_t size) {
+        m_buffer.resize((m_buffer.size() + 7) / 8 * 8, '\0');
+
+        const auto offset = m_buffer.size();
+        m_buffer.append(static_cast<const char *>(data), size);
+        return offset;
+    }
+
+    template<typename T>
+    uint64_t append(const std::vector<T> &values) { return append(values.data(), values.size() * sizeof(T)); }
+
+    void overwrite(const uint64_t offset, const void *data, const size_t size) {
+        std::memcpy(m_buffer.data() + offset, data, size);
+    }
+
+    const std::string &buffer() const { return m_buffer; }
+
+    /**
+     * @brief Appends a columnar dataset
+     * @param dataset The dataset, which must have been finished
+     * @param source The fingerprint of the file the dataset was read from
+     */
+    void append(const ColumnarDataset &dataset, const SourceFingerprint &source) {
+        BinaryHeader header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.byte_order = BYTE_ORDER_MARK;
+        header.source = source;
+        header.n_structures = dataset.n_structures();
+
+        const auto header_offset = append(&header, sizeof(header));
+
+        header.tables[0] = append(dataset.props);
+        header.tables[1] = append(dataset.atoms);
+        header.tables[2] = append(dataset.bonds);
+
+        overwrite(header_offset, &header, sizeof(header));
+    }
+
+private:
+    uint64_t append(const ColumnarTable &table) {
+        std::vector<BinaryColumn> columns;
+
+        append_columns(table.bools, ColumnType::Bool, columns);
+        append_columns(table.ints, ColumnType::Int, columns);
+        append_columns(table.reals, ColumnType::Real, columns);
+        append_columns(table.strings, ColumnType::String, columns);
+
+        const BinaryTable binary_table{
+            table.n_rows, columns.size(), append(table.offsets), append(table.present.bytes()), append(columns)
+        };
+        return append(&binary_table, sizeof(binary_table));
+    }
+
+    template<typename T>
+    void append_columns(const std::map<std::string, ColumnBuilder<T> > &table_columns,
+                        const ColumnType type,
+                        std::vector<BinaryColumn> &columns) {
+        for (const auto &[key, column]: table_columns) {
+            BinaryColumn binary_column{};
+            binary_column.name = append(key.data(), key.size());
+            binary_column.name_size = key.size();
+            binary_column.type = type;
+            binary_column.present = append(column.present.bytes());
+            binary_column.nulls = column.nulls.any() ? append(column.nulls.bytes()) : 0;
+
+            if constexpr (std::is_same_v<T, std::string>) {
+                std::vector<uint64_t> offsets{0};
+                std::string strings;
+
+                for (const auto &value: column.values) {
+                    strings += value;
+                    offsets.push_back(strings.size());
+                }
+                binary_column.values = append(offsets);
+                binary_column.strings = append(strings.data(), strings.size());
+            } else {
+                binary_column.values = append(column.values);
+            }
+
+            columns.push_back(binary_column);
+        }
+    }
+
+    std::string m_buffer;
+};
+
+/**
+ * @brief A bounds checked view over the contents of a binary MAE file
+ */
+class BinaryView {
+public:
+    BinaryView(const char *data, const size_t size) : m_data(data), m_size(size) {
+    }
+
+    /**
+     * @brief Returns a pointer to count values of type T stored at an offset
+     * @throws std::runtime_error If the values are misaligned or lie outside the file
+     */
+    template<typename T>
+    const T *get(const uint64_t offset, const uint64_t count = 1) const {
+        if (offset % alignof(T) != 0 || offset > m_size || count > (m_size - offset) / sizeof(T)) {
+            throw std::runtime_error("The binary MAE file is corrupt");
+        }
+        return reinterpret_cast<const T *>(m_data + offset);
+    }
+
+    const BinaryHeader &header() const { return *get<BinaryHeader>(0); }
+
+    size_t size() const { return m_size; }
+
+    /**
+     * @brief Checks that the view contains a binary MAE file in a version and byte order this module can read
+     */
+    bool is_valid() const {
+        if (m_size < sizeof(BinaryHeader)) { return false; }
+
+        const auto &h = header();
+        return std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) == 0 && h.version == VERSION && h.byte_order == BYTE_ORDER_MARK;
+    }
+
+private:
+    const char *m_data;
+    size_t m_size;
+};
+
+/**
+ * @brief A column of a binary MAE file with its sections resolved to pointers
+ */
+struct ColumnView {
+    std::string name;
+    nb::str key;
+    ColumnType type;
+    const uint8_t *present;
+    const uint8_t *nulls;
+    const void *values;
+    const char *strings;
+
+    bool is_present(const size_t structure) const { return present[structure >> 3] >> (structure & 7) & 1; }
+
+    bool is_null(const size_t row) const { return nulls && nulls[row >> 3] >> (row & 7) & 1; }
+
+    nb::object value(const size_t row) const {
+        if (is_null(row)) { return nb::none(); }
+
+        switch (type) {
+            case ColumnType::Bool:
+                return nb::cast(static_cast<const uint8_t *>(values)[row] != 0);
+            case ColumnType::Int:
+                return nb::cast(static_cast<const int32_t *>(values)[row]);
+            case ColumnType::Real:
+                return nb::cast(static_cast<const double *>(values)[row]);
+            default:
+                const auto offsets = static_cast<const uint64_t *>(values);
+                return nb::str(strings + offsets[row], offsets[row + 1] - offsets[row]);
+        }
+    }
+};
+
+/**
+ * @brief A table of a binary MAE file with its sections resolved to pointers
+ */
+struct TableView {
+    uint64_t n_rows;
+    const uint64_t *offsets;
+    const uint8_t *present;
+    std::vector<ColumnView> columns;
+
+    TableView(const BinaryView &view, const uint64_t offset, const uint64_t n_structures) {
+        // every structure has a row offset, so a larger count is corrupt, and would overflow the counts below
+        if (n_structures >= view.size() / sizeof(uint64_t)) {
+            throw std::runtime_error("The binary MAE file is corrupt");
+        }
+
+        const auto &table = *view.get<BinaryTable>(offset);
+        const auto n_structure_bytes = (n_structures + 7) / 8;
+
+        n_rows = table.n_rows;
+        offsets = view.get<uint64_t>(table.offsets, n_structures + 1);
+        present = view.get<uint8_t>(table.present, n_structure_bytes);
+
+        if (offsets[n_structures] != n_rows) {
+            throw std::runtime_error("The binary MAE file is corrupt");
+        }
+
+        const auto binary_columns = view.get<BinaryColumn>(table.columns, table.n_columns);
+
+        for (uint64_t i = 0; i < table.n_columns; ++i) {
+            const auto &column = binary_columns[i];
+            ColumnView column_view{};
+
+            column_view.name = std::string(view.get<char>(column.name, column.name_size), column.name_size);
+            column_view.key = nb::str(column_view.name.c_str(), column_view.name.size());
+            column_view.type = column.type;
+            column_view.present = view.get<uint8_t>(column.present, n_structure_bytes);
+            column_view.nulls = column.nulls ? view.get<uint8_t>(column.nulls, (n_rows + 7) / 8) : nullptr;
+
+            switch (column.type) {
+                case ColumnType::Bool:
+                    column_view.values = view.get<uint8_t>(column.values, n_rows);
+                    break;
+                case ColumnType::Int:
+                    column_view.values = view.get<int32_t>(column.values, n_rows);
+                    break;
+                case ColumnType::Real:
+                    column_view.values = view.get<double>(column.values, n_rows);
+                    break;
+                case ColumnType::String: {
+                    const auto string_offsets = view.get<uint64_t>(column.values, n_rows + 1);
+                    column_view.values = string_offsets;
+                    column_view.strings = view.get<char>(column.strings, string_offsets[n_rows]);
+
+                    for (uint64_t row = 0; row < n_rows; ++row) {
+                        if (string_offsets[row] > string_offsets[row + 1]) {
+                            throw std::runtime_error("The binary MAE file is corrupt");
+                        }
+                    }
+                    break;
+                }
+                default:
+                    throw std::runtime_error("The binary MAE file is corrupt");
+            }
+
+            columns.push_back(std::move(column_view));
+        }
+    }
+
+    bool is_present(const size_t structure) const { return present[structure >> 3] >> (structure & 7) & 1; }
+
+    /**
+     * @brief Converts the rows of a structure to a dictionary of Python lists
+     */
+    nb::dict convert(const size_t structure) const {
+        nb::dict result;
+
+        const auto begin = offsets[structure], end = offsets[structure + 1];
+
+        if (begin > end || end > n_rows) {
+            throw std::runtime_error("The binary MAE file is corrupt");
+        }
+
+        for (const auto &column: columns) {
+            if (!column.is_present(structure)) { continue; }
+
+            nb::list values;
+            for (auto row = begin; row < end; ++row) { values.append(column.value(row)); }
+
+            result[column.key] = values;
+        }
+        return result;
+    }
+};
+
+/**
+ * @brief Converts structures stored in the tables of a binary MAE file to Python dictionaries
+ * @param props The CT property table
+ * @param atoms The atom table
+ * @param bonds The bond table
+ * @param n_structures The number of structures in the file
+ * @param slice The structures to convert
+ * @return The structures, in the same format as returned by convert_block
+ */
+std::vector<nb::dict> convert_binary(const TableView &props,
+                                     const TableView &atoms,
+                                     const TableView &bonds,
+                                     const uint64_t n_structures,
+                                     const Slice &slice) {
+    std::vector<nb::dict> structures;
+
+    for (uint64_t i = slice.start; i < std::min(slice.stop, n_structures); i += slice.step) {
+        nb::dict structure;
+        nb::dict structure_props;
+
+        for (const auto &column: props.columns) {
+            if (!column.is_present(i)) { continue; }
+
+            if (column.name == schrodinger::mae::CT_TITLE) {
+                structure["title"] = column.value(props.offsets[i]);
+            } else {
+                structure_props[column.key] = column.value(props.offsets[i]);
+            }
+        }
+        structure["props"] = structure_props;
+
+        if (atoms.is_present(i)) { structure["atoms"] = atoms.convert(i); }
+        if (bonds.is_present(i)) { structure["bonds"] = bonds.convert(i); }
+
+        structures.push_back(structure);
+    }
+
+    return structures;
+}
+
+/**
+ * @brief Converts the structures stored in a binary MAE file to Python dictionaries
+ * @param view The contents of the file, which must be valid
+ * @param slice The structures to convert
+ * @return The structures, in the same format as returned by convert_block
+ */
+std::vector<nb::dict> convert_binary(const BinaryView &view, const Slice &slice = {}) {
+    const auto n_structures = view.header().n_structures;
+
+    const TableView props(view, view.header().tables[0], n_structures);
+    const TableView atoms(view, view.header().tables[1], n_structures);
+    const TableView bonds(view, view.header().tables[2], n_structures);
+
+    return convert_binary(props, atoms, bonds, n_structures, slice);
+}
+} // namespace binary
+
+/**
+ * @brief Options controlling which properties contribute to the hash of a structure
+ */
+struct HashOptions {
+    bool coordinates = true; ///< Whether to hash the atom coordinates
+    bool display = true; ///< Whether to hash display-only properties such as colors, labels and representations
+
+    bool includes(const std::string &name) const {
+        static const std::vector<std::string> coordinate_properties = {"r_m_x_coord", "r_m_y_coord", "r_m_z_coord"};
+        static const std::vector<std::string> display_patterns = {
+            "*_m_*color*", "*_m_label_*", "*_m_ribbon_*", "i_m_representation", "i_m_visibility", "i_m_*_rep"
+        };
+        const auto matches = [&name](const std::vector<std::string> &patterns) {
+            return std::any_of(patterns.begin(), patterns.end(), [&name](const auto &p) { return glob_match(p, name); });
+        };
+
+        return (coordinates || !matches(coordinate_properties)) && (display || !matches(display_patterns));
+    }
+};
+
+/**
+ * @brief Hashes a single value, treating -0.0 and 0.0 as equal
+ */
+template<typename T>
+void hash_value(Hasher &hasher, const T &value) {
+    if constexpr (std::is_same_v<T, double>) {
+        hasher.update(value == 0.0 ? 0.0 : value);
+    } else {
+        hasher.update(value);
+    }
+}
+
+/**
+ * @brief Hashes a value stored in a column of a binary MAE file in the same way as hash_value
+ */
+void hash_value(Hasher &hasher, const binary::ColumnView &column, const size_t row) {
+    switch (column.type) {
+        case ColumnType::Bool:
+            return hash_value(hasher, static_cast<const uint8_t *>(column.values)[row]);
+        case ColumnType::Int:
+            return hash_value(hasher, static_cast<const int32_t *>(column.values)[row]);
+        case ColumnType::Real:
+            return hash_value(hasher, static_cast<const double *>(column.values)[row]);
+        default:
+            const auto offsets = static_cast<const uint64_t *>(column.values);
+            return hash_value(hasher, std::string(column.strings + offsets[row], offsets[row + 1] - offsets[row]));
+    }
+}
+
+template<typename T>
+constexpr ColumnType column_type() {
+    if constexpr (std::is_same_v<T, uint8_t>) {
+        return ColumnType::Bool;
+    } else if constexpr (std::is_same_v<T, int>) {
+        return ColumnType::Int;
+    } else if constexpr (std::is_same_v<T, double>) {
+        return ColumnType::Real;
+    } else {
+        return ColumnType::String;
+    }
+}
+
+template<typename T>
+void hash_properties(Hasher &hasher, const std::map<std::string, T> &props, const HashOptions &options) {
+    for (const auto &[key, value]: props) {
+        if (!options.includes(key)) { continue; }
+
+        hasher.update(key);
+        hasher.update(column_type<T>());
+        hash_value(hasher, value);
+    }
+}
+
+template<typename T>
+void hash_indexed_properties(Hasher &hasher,
+                             const std::map<std::string, std::shared_ptr<schrodinger::mae::IndexedProperty<T> > > &props,
+                             const size_t size,
+                             const HashOptions &options) {
+    for (const auto &[key, property]: props) {
+        if (!options.includes(key)) { continue; }
+
+        hasher.update(key);
+        hasher.update(column_type<T>());
+
+        for (size_t i = 0; i < size; ++i) {
+            const uint8_t defined = property->isDefined(i);
+            hasher.update(defined);
+
+            if (defined) { hash_value(hasher, property->at(i)); }
+        }
+    }
+}
+
+void hash_indexed_block(Hasher &hasher, const schrodinger::mae::IndexedBlock *block, const HashOptions &options) {
+    hasher.update<uint8_t>(block != nullptr);
+
+    if (!block) { return; }
+
+    hasher.update<uint64_t>(block->size());
+
+    hash_indexed_properties(hasher, block->getProperties<uint8_t>(), block->size(), options);
+    hash_indexed_properties(hasher, block->getProperties<int>(), block->size(), options);
+    hash_indexed_properties(hasher, block->getProperties<double>(), block->size(), options);
+    hash_indexed_properties(hasher, block->getProperties<std::string>(), block->size(), options);
+}
+
+/**
+ * @brief Hashes the content of a structure, see hash_block
+ * @return The hasher, from which either a 64-bit (digest) or 128-bit (digest128) hash can be taken
+ */
+Hasher hash_block_state(const schrodinger::mae::Block &block, const HashOptions &options) {
+    Hasher hasher;
+
+    hash_properties(hasher, block.getProperties<uint8_t>(), options);
+    hash_properties(hasher, block.getProperties<int>(), options);
+    hash_properties(hasher, block.getProperties<double>(), options);
+    hash_properties(hasher, block.getProperties<std::string>(), options);
+
+    hash_indexed_block(hasher, get_indexed_block(block, schrodinger::mae::ATOM_BLOCK).get(), options);
+    hash_indexed_block(hasher, get_indexed_block(block, schrodinger::mae::BOND_BLOCK).get(), options);
+
+    return hasher;
+}
+
+/**
+ * @brief Computes a 64-bit hash of the content of a structure
+ * @details The hash is computed from the typed values of the CT, atom and bond properties, in the same order as
+ *          they are stored in a binary MAE file, so that hash_binary produces identical hashes.
+ * @param block The CT block of the structure
+ * @param options Which properties to include in the hash
+ * @return The hash of the structure
+ */
+uint64_t hash_block(const schrodinger::mae::Block &block, const HashOptions &options) {
+    return hash_block_state(block, options).digest();
+}
+
+/**
+ * @brief Computes the hashes of the structures stored in a binary MAE file, identical to those of hash_block
+ * @param view The contents of the file, which must be valid
+ * @param options Which properties to include in the hashes
+ * @param slice The structures to hash
+ * @return The hash of each structure
+ */
+std::vector<uint64_t> hash_binary(const binary::BinaryView &view, const HashOptions &options,
+                                  const Slice &slice = {}) {
+    const auto n_structures = view.header().n_structures;
+
+    const binary::TableView props(view, view.header().tables[0], n_structures);
+    const binary::TableView atoms(view, view.header().tables[1], n_structures);
+    const binary::TableView bonds(view, view.header().tables[2], n_structures);
+
+    std::vector<uint64_t> hashes;
+
+    for (uint64_t i = slice.start; i < std::min(slice.stop, n_structures); i += slice.step) {
+        Hasher hasher;
+
+        for (const auto &column: props.columns) {
+            if (!column.is_present(i) || !options.includes(column.name)) { continue; }
+
+            hasher.update(column.name);
+            hasher.update(column.type);
+            hash_value(hasher, column, props.offsets[i]);
+        }
+
+        for (const auto *table: {&atoms, &bonds}) {
+            hasher.update<uint8_t>(table->is_present(i));
+
+            if (!table->is_present(i)) { continue; }
+
+            const auto begin = table->offsets[i], end = table->offsets[i + 1];
+            hasher.update<uint64_t>(end - begin);
+
+            for (const auto &column: table->columns) {
+                if (!column.is_present(i) || !options.includes(column.name)) { continue; }
+
+                hasher.update(column.name);
+                hasher.update(column.type);
+
+                for (auto row = begin; row < end; ++row) {
+                    const uint8_t defined = !column.is_null(row);
+                    hasher.update(defined);
+
+                    if (defined) { hash_value(hasher, column, row); }
+                }
+            }
+        }
+
+        hashes.push_back(hasher.digest());
+    }
+
+    return hashes;
+}
+
+/**
+ * @brief A problem found in a structure by validate_block, or which prevented it from being read
+ */
+struct StructureIssue {
+    size_t structure; ///< The index of the structure in its file, or in the structures being written
+    std::optional<uint64_t> offset; ///< The offset of the structure in the decompressed file, if it was read
+    std::string message;
+};
+
+/**
+ * @brief Thrown when structures fail validation, and translated to pymaeparser_ext.ValidationError, a ValueError
+ *        with the issues available as its errors attribute
+ */
+class ValidationException : public std::runtime_error {
+public:
+    explicit ValidationException(std::vector<StructureIssue> issues)
+        : std::runtime_error(describe(issues)), m_issues(std::move(issues)) {
+    }
+
+    const std::vector<StructureIssue> &issues() const { return m_issues; }
+
+private:
+    static std::string describe(const std::vector<StructureIssue> &issues) {
+        const auto &first = issues.front();
+
+        auto message = "Structure " + std::to_string(first.structure);
+        if (first.offset) { message += " at offset " + std::to_string(*first.offset); }
+        message += " is invalid: " + first.message;
+
+        if (issues.size() > 1) { message += " (and " + std::to_string(issues.size() - 1) + " more issues)"; }
+
+        return message;
+    }
+
+    std::vector<StructureIssue> m_issues;
+};
+
+constexpr const char *REQUIRED_ATOM_COLUMNS[] = {"r_m_x_coord", "r_m_y_coord", "r_m_z_coord", "i_m_atomic_number"};
+constexpr const char *REQUIRED_BOND_COLUMNS[] = {"i_m_from", "i_m_to", "i_m_order"};
+
+/**
+ * @brief Checks that every column of an indexed block has a value for each of its rows
+ */
+template<typename T>
+void validate_column_sizes(const std::map<std::string, std::shared_ptr<schrodinger::mae::IndexedProperty<T> > > &props,
+                           const std::string &name,
+                           const size_t size,
+                           std::vector<std::string> &issues) {
+    for (const auto &[key, property]: props) {
+        if (property->size() != size) {
+            issues.push_back(name + " column " + key + " has " + std::to_string(property->size()) + " values, expected " +
+                             std::to_string(size));
+        }
+    }
+}
+
+/**
+ * @brief Checks that an indexed block has each of a set of columns, and that all of its columns have equal lengths
+ */
+template<size_t N>
+void validate_indexed_block(const schrodinger::mae::IndexedBlock &block,
+                            const std::string &name,
+                            const char *const (&required)[N],
+                            std::vector<std::string> &issues) {
+    const auto has_column = [&block](const std::string &key) {
+        return block.getProperties<uint8_t>().count(key) || block.getProperties<int>().count(key) ||
+               block.getProperties<double>().count(key) || block.getProperties<std::string>().count(key);
+    };
+
+    for (const auto *key: required) {
+        if (!has_column(key)) { issues.push_back(name + " is missing required column " + key); }
+    }
+
+    validate_column_sizes(block.getProperties<uint8_t>(), name, block.size(), issues);
+    validate_column_sizes(block.getProperties<int>(), name, block.size(), issues);
+    validate_column_sizes(block.getProperties<double>(), name, block.size(), issues);
+    validate_column_sizes(block.getProperties<std::string>(), name, block.size(), issues);
+}
+
+/**
+ * @brief Checks a CT block for problems that would make it unusable as a structure
+ * @details The atom and bond blocks must have all of their required columns, every column must have the same
+ *          length as the other columns of its block, and every bond must join two atoms within 1..n_atoms.
+ * @param block The CT block to check
+ * @return A description of each problem found
+ */
+std::vector<std::string> validate_block(const schrodinger::mae::Block &block) {
+    std::vector<std::string> issues;
+
+    const auto atoms = get_indexed_block(block, schrodinger::mae::ATOM_BLOCK);
+    const auto bonds = get_indexed_block(block, schrodinger::mae::BOND_BLOCK);
+
+    if (atoms) { validate_indexed_block(*atoms, schrodinger::mae::ATOM_BLOCK, REQUIRED_ATOM_COLUMNS, issues); }
+    if (!bonds) { return issues; }
+
+    validate_indexed_block(*bonds, schrodinger::mae::BOND_BLOCK, REQUIRED_BOND_COLUMNS, issues);
+
+    const auto n_atoms = atoms ? atoms->size() : 0;
+    const auto &props = bonds->getProperties<int>();
+
+    for (const auto *key: {"i_m_from", "i_m_to"}) {
+        const auto column = props.find(key);
+        if (column == props.end()) { continue; }
+
+        const auto &property = *column->second;
+
+        for (size_t i = 0; i < std::min(property.size(), bonds->size()); ++i) {
+            const auto bond = "m_bond " + std::to_string(i + 1);
+
+            if (!property.isDefined(i)) {
+                issues.push_back(bond + " has an undefined " + key);
+            } else if (property.at(i) < 1 || static_cast<size_t>(property.at(i)) > n_atoms) {
+                issues.push_back(bond + " has " + key + " " + std::to_string(property.at(i)) + ", outside 1.." +
+                                 std::to_string(n_atoms));
+            }
+        }
+    }
+
+    return issues;
+}
+
+/**
+ * @brief Validates a CT block (see validate_block), recording any problems found as issues of a structure
+ */
+void validate_structure(const schrodinger::mae::Block &block,
+                        const size_t structure,
+                        const std::optional<uint64_t> offset,
+                        std::vector<StructureIssue> &issues) {
+    for (auto &message: validate_block(block)) { issues.push_back({structure, offset, std::move(message)}); }
+}
+
+/**
+ * @brief Options controlling how MAE files are read
+ */
+struct ReadOptions {
+    bool cache = false; ///< Whether to read from, or store structures in, a binary cache (<filename>.maebin)
+    bool return_hashes = false; ///< Whether to compute the hash of each structure
+    bool hash_coordinates = true; ///< Whether to include coordinates in the hashes
+    bool hash_display = true; ///< Whether to include display-only properties in the hashes
+    uint64_t start = 0; ///< The index of the first structure to read
+    uint64_t stop = std::numeric_limits<uint64_t>::max(); ///< The index to stop reading structures at
+    uint64_t step = 1; ///< The step between the indices of the structures to read
+    bool lazy = false; ///< Whether to return Structure objects rather than dictionaries
+    bool pipelined = false; ///< Whether to decompress, parse and convert structures on separate threads
+    size_t chunk_queue_depth = 16; ///< The maximum number of decompressed chunks waiting to be parsed
+    size_t block_queue_depth = 256; ///< The maximum number of parsed structures waiting to be converted
+    bool validate = false; ///< Whether to check the structures with validate_block, bypassing any cache
+    bool skip_errors = false; ///< Whether to skip structures which cannot be read, bypassing any cache
+    size_t n_threads = 1; ///< The number of threads to convert structures to Python objects on
+    BoolFormat bool_format = BoolFormat::List; ///< How b_ columns of atoms and bonds are converted
+    ColumnFormat column_format = ColumnFormat::List; ///< How other columns of atoms and bonds are converted. Any
+                                                     ///< cache is bypassed unless every column is a list
+
+    HashOptions hash_options() const { return {hash_coordinates, hash_display}; }
+
+    ConvertOptions convert_options() const { return {lazy, bool_format, column_format}; }
+
+    Slice slice() const { return {start, stop, step}; }
+};
+
+/**
+ * @brief The structures read from an MAE file
+ */
+struct ReadResult {
+    std::vector<nb::object> structures;
+    std::vector<uint64_t> hashes; ///< The hash of each structure, if requested
+    std::vector<StructureIssue> errors; ///< Why each skipped structure could not be read, if skipping errors
+};
+
+/**
+ * @brief Converts a parsed CT block to a dictionary (see convert_block), or wraps it in a Structure if lazy
+ */
+nb::object convert_structure(std::shared_ptr<schrodinger::mae::Block> block,
+                             const ConvertOptions &options,
+                             StructureSchema &schema) {
+    if (options.lazy) { return nb::cast(Structure(std::move(block), options)); }
+    return convert_block(*block, schema, options);
+}
+
+/**
+ * @brief Converts parsed CT blocks to Python objects (see convert_structure), in batches on several threads
+ * @details Each thread attaches to the interpreter to create Python objects, so structures are only converted
+ *          in parallel on free-threaded builds of Python. Otherwise the threads take turns holding the GIL, and
+ *          conversion is no faster than on a single thread.
+ */
+class StructureConverter {
+public:
+    static constexpr size_t BATCH_SIZE = 4096;
+
+    /**
+     * @param structures The vector to append the converted structures to, in the order they are added
+     * @param options How the blocks are converted
+     * @param n_threads The number of threads to convert structures on
+     */
+    StructureConverter(std::vector<nb::object> &structures, const ConvertOptions &options, const size_t n_threads)
+        : m_structures(structures), m_options(options), m_n_threads(n_threads) {
+    }
+
+    void add(std::shared_ptr<schrodinger::mae::Block> block) {
+        if (m_n_threads <= 1) {
+            m_structures.push_back(convert_structure(std::move(block), m_options, m_schema));
+            return;
+        }
+
+        m_blocks.push_back(std::move(block));
+
+        if (m_blocks.size() >= BATCH_SIZE) { flush(); }
+    }
+
+    /**
+     * @brief Converts any blocks which have been added but not yet converted
+     */
+    void flush() {
+        const auto offset = m_structures.size();
+        m_structures.resize(offset + m_blocks.size());
+
+        std::atomic<size_t> next = 0;
+        std::exception_ptr error;
+        {
+            nb::gil_scoped_release release;
+
+            std::mutex error_mutex;
+            std::vector<std::thread> threads;
+
+            for (size_t i = 0; i < std::min(m_n_threads, m_blocks.size()); ++i) {
+                threads.emplace_back([&] {
+                    nb::gil_scoped_acquire acquire;
+                    StructureSchema schema;
+
+                    try {
+                        for (size_t j; (j = next++) < m_blocks.size();) {
+                            m_structures[offset + j] = convert_structure(std::move(m_blocks[j]), m_options, schema);
+                        }
+                    } catch (...) {
+                        std::lock_guard lock(error_mutex);
+                        if (!error) { error = std::current_exception(); }
+
+                        next = m_blocks.size();
+                    }
+                });
+            }
+            for (auto &thread: threads) { thread.join(); }
+        }
+        m_blocks.clear();
+
+        if (error) { std::rethrow_exception(error); }
+    }
+
+private:
+    std::vector<nb::object> &m_structures;
+    ConvertOptions m_options;
+    size_t m_n_threads;
+    StructureSchema m_schema; ///< The schema of the structures converted on the calling thread
+
+    std::vector<std::shared_ptr<schrodinger::mae::Block> > m_blocks;
+};
+
+/**
+ * @brief Reads the structures stored in a binary MAE cache file if it is up to date
+ * @param filename Path to the cache file
+ * @param source The fingerprint of the MAE file the cache was created from
+ * @param options Which structure hashes to compute, if any
+ * @return The cached structures, or std::nullopt if the cache is missing, stale or cannot be read
+ */
+std::optional<ReadResult> read_mae_cache(const std::string &filename,
+                                         const SourceFingerprint &source,
+                                         const ReadOptions &options) {
+    if (!std::filesystem::exists(filename)) { return std::nullopt; }
+
+    try {
+        const boost::iostreams::mapped_file_source file(filename);
+        const binary::BinaryView view(file.data(), file.size());
+
+        if (!view.is_valid() || !(view.header().source == source)) { return std::nullopt; }
+
+        ReadResult result;
+        for (auto &structure: binary::convert_binary(view, options.slice())) {
+            result.structures.push_back(options.lazy ? nb::cast(Structure(structure)) : std::move(structure));
+        }
+
+        if (options.return_hashes) { result.hashes = hash_binary(view, options.hash_options(), options.slice()); }
+
+        return result;
+    } catch (const std::exception &) {
+        return std::nullopt;
+    }
+}
+
+/**
+ * @brief Writes a binary MAE cache file, replacing any existing cache atomically
+ * @details Failing to write the cache is not an error, as the cache is only an optimization.
+ * @param filename Path to the cache file
+ * @param dataset The structures to cache, which must have been finished
+ * @param source The fingerprint of the MAE file the structures were read from
+ */
+void write_mae_cache(const std::string &filename, const ColumnarDataset &dataset, const SourceFingerprint &source) {
+    binary::BinaryWriter writer;
+    writer.append(dataset, source);
+
+    const auto cache_filename = temporary_filename(filename);
+    {
+        std::ofstream file(cache_filename, std::ios_base::out | std::ios_base::binary);
+        file.write(writer.buffer().data(), static_cast<std::streamsize>(writer.buffer().size()));
+
+        if (!file) {
+            std::error_code error;
+            std::filesystem::remove(cache_filename, error);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(cache_filename, filename, error);
+
+    if (error) { std::filesystem::remove(cache_filename, error); }
+}
+
+/**
+ * @brief A point in a GZipped file from which decompression can be resumed, as in zlib's zran example
+ */
+struct GzipCheckpoint {
+    static constexpr size_t WINDOW_SIZE = 32768;
+
+    uint64_t output; ///< The offset of the checkpoint in the decompressed data
+    uint64_t input; ///< The offset of the first complete byte of the checkpoint in the compressed file
+    uint32_t bits; ///< The number of bits of the preceding byte that belong to the checkpoint
+    uint32_t window_size; ///< The number of bytes of window which precede the checkpoint
+    uint8_t window[WINDOW_SIZE]; ///< The decompressed data preceding the checkpoint, ending at its end
+};
+
+static_assert(sizeof(GzipCheckpoint) % 8 == 0);
+
+/**
+ * @brief Decompresses a GZipped file while recording a checkpoint at a deflate block boundary roughly every
+ *        span bytes of decompressed data, so that it can later be decompressed from near any offset
+ */
+class GzipIndexingBuffer : public std::streambuf {
+public:
+    explicit GzipIndexingBuffer(const std::string &filename, const uint64_t span = 1 << 20)
+        : m_file(filename, std::ios_base::in | std::ios_base::binary), m_span(span), m_input(1 << 16),
+          m_window(GzipCheckpoint::WINDOW_SIZE) {
+        if (!m_file) {
+            throw std::runtime_error("Could not open file: " + filename);
+        }
+        if (inflateInit2(&m_stream, 47) != Z_OK) {
+            throw std::runtime_error("Could not initialize zlib");
+        }
+    }
+
+    ~GzipIndexingBuffer() override { inflateEnd(&m_stream); }
+
+    GzipIndexingBuffer(const GzipIndexingBuffer &) = delete;
+    GzipIndexingBuffer &operator=(const GzipIndexingBuffer &) = delete;
+
+    std::vector<GzipCheckpoint> &checkpoints() { return m_checkpoints; }
+
+protected:
+    int_type underflow() override {
+        while (gptr() == egptr()) {
+            if (m_stream.avail_in == 0) {
+                m_file.read(m_input.data(), static_cast<std::streamsize>(m_input.size()));
+
+                if (m_file.gcount() == 0) {
+                    if (m_in_member) { throw std::runtime_error("The GZipped file is truncated"); }
+                    return traits_type::eof();
+                }
+                m_stream.next_in = reinterpret_cast<Bytef *>(m_input.data());
+                m_stream.avail_in = static_cast<uInt>(m_file.gcount());
+            }
+            if (m_stream.avail_out == 0) {
+                m_stream.next_out = m_window.data();
+                m_stream.avail_out = static_cast<uInt>(m_window.size());
+            }
+
+            const auto start = m_stream.next_out;
+
+            m_total_in += m_stream.avail_in;
+            m_total_out += m_stream.avail_out;
+            const auto result = inflate(&m_stream, Z_BLOCK);
+            m_total_in -= m_stream.avail_in;
+            m_total_out -= m_stream.avail_out;
+
+            if (result == Z_STREAM_END) {
+                // the file may contain further gzip members, whose headers inflate detects after a reset
+                inflateReset(&m_stream);
+                m_in_member = false;
+            } else if (result == Z_OK || result == Z_BUF_ERROR) {
+                m_in_member = true;
+
+                const auto at_block_boundary = (m_stream.data_type & 128) && !(m_stream.data_type & 64);
+
+                if (at_block_boundary &&
+                    (m_checkpoints.empty() || m_total_out - m_checkpoints.back().output > m_span)) {
+                    add_checkpoint();
+                }
+            } else {
+                throw std::runtime_error(std::string("Could not decompress the GZipped file: ") +
+                                         (m_stream.msg ? m_stream.msg : "invalid data"));
+            }
+
+            setg(reinterpret_cast<char *>(start), reinterpret_cast<char *>(start),
+                 reinterpret_cast<char *>(m_stream.next_out));
+        }
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    void add_checkpoint() {
+        auto &checkpoint = m_checkpoints.emplace_back();
+
+        checkpoint.output = m_total_out;
+        checkpoint.input = m_total_in;
+        checkpoint.bits = static_cast<uint32_t>(m_stream.data_type & 7);
+        checkpoint.window_size = static_cast<uint32_t>(std::min<uint64_t>(m_total_out, m_window.size()));
+
+        // the window is circular, with the oldest bytes following the next output position
+        const size_t left = m_stream.avail_out;
+
+        std::memcpy(checkpoint.window, m_window.data() + m_window.size() - left, left);
+        std::memcpy(checkpoint.window + left, m_window.data(), m_window.size() - left);
+    }
+
+    std::ifstream m_file;
+    uint64_t m_span;
+
+    z_stream m_stream{};
+    std::vector<char> m_input;
+    std::vector<Bytef> m_window;
+    bool m_in_member = false;
+
+    uint64_t m_total_in = 0;
+    uint64_t m_total_out = 0;
+    std::vector<GzipCheckpoint> m_checkpoints;
+};
+
+/**
+ * @brief An input stream over a GzipIndexingBuffer
+ */
+class GzipIndexingStream : public std::istream {
+public:
+    explicit GzipIndexingStream(const std::string &filename) : std::istream(nullptr), m_buffer(filename) {
+        rdbuf(&m_buffer);
+    }
+
+    std::vector<GzipCheckpoint> &checkpoints() { return m_buffer.checkpoints(); }
+
+private:
+    GzipIndexingBuffer m_buffer;
+};
+
+/**
+ * @brief Decompresses a range of a GZipped file, starting from a checkpoint preceding it
+ * @param filename Path to the GZipped file
+ * @param checkpoint A checkpoint recorded by GzipIndexingBuffer at or before the start of the range
+ * @param begin The offset of the start of the range in the decompressed data
+ * @param end The offset of the end of the range in the decompressed data, or the maximum uint64_t value to read
+ *        to the end of the data
+ * @return The decompressed bytes of the range
+ * @throws std::runtime_error If the data ends before the end of the range, e.g. if the file was truncated
+ */
+std::string read_gzip_range(const std::string &filename,
+                            const GzipCheckpoint &checkpoint,
+                            const uint64_t begin,
+                            const uint64_t end) {
+    std::ifstream file(filename, std::ios_base::in | std::ios_base::binary);
+
+    z_stream stream{};
+
+    if (!file || inflateInit2(&stream, -15) != Z_OK) {
+        throw std::runtime_error("Could not read file: " + filename);
+    }
+
+    const std::unique_ptr<z_stream, int (*)(z_stream *)> guard(&stream, inflateEnd);
+
+    file.seekg(static_cast<std::streamoff>(checkpoint.input - (checkpoint.bits ? 1 : 0)));
+
+    if (checkpoint.bits) {
+        const auto byte = file.get();
+        inflatePrime(&stream, static_cast<int>(checkpoint.bits), byte >> (8 - checkpoint.bits));
+    }
+    if (checkpoint.window_size > 0) {
+        inflateSetDictionary(&stream, checkpoint.window + GzipCheckpoint::WINDOW_SIZE - checkpoint.window_size,
+                             checkpoint.window_size);
+    }
+
+    std::vector<char> input(1 << 16);
+    std::vector<char> output(1 << 16);
+
+    std::string text;
+    uint64_t position = checkpoint.output;
+    bool raw = true;
+
+    while (position < end) {
+        if (stream.avail_in == 0) {
+            file.read(input.data(), static_cast<std::streamsize>(input.size()));
+
+            if (file.gcount() == 0) {
+                if (end == std::numeric_limits<uint64_t>::max()) { break; }
+
+                throw std::runtime_error("The GZipped file ends before the structure at byte " +
+                                         std::to_string(begin) + ": " + filename);
+            }
+
+            stream.next_in = reinterpret_cast<Bytef *>(input.data());
+            stream.avail_in = static_cast<uInt>(file.gcount());
+        }
+
+        stream.next_out = reinterpret_cast<Bytef *>(output.data());
+        stream.avail_out = static_cast<uInt>(output.size());
+
+        const auto result = inflate(&stream, Z_NO_FLUSH);
+        const auto produced = output.size() - stream.avail_out;
+
+        if (position + produced > begin) {
+            const auto first = begin > position ? begin - position : 0;
+            const auto last = std::min<uint64_t>(produced, end - position);
+
+            text.append(output.data() + first, last - first);
+        }
+        position += produced;
+
+        if (result == Z_STREAM_END) {
+            if (raw) {
+                // skip the trailer of the member, as raw inflate does not consume it
+                const auto skipped = std::min<uInt>(stream.avail_in, 8);
+                stream.next_in += skipped;
+                stream.avail_in -= skipped;
+                file.ignore(8 - skipped);
+
+                raw = false;
+                inflateReset2(&stream, 31);
+            } else {
+                inflateReset(&stream);
+            }
+        } else if (result != Z_OK && result != Z_BUF_ERROR) {
+            throw std::runtime_error("Could not decompress file: " + filename);
+        }
+    }
+
+    return text;
+}
+
+/**
+ * @brief The header of an index sidecar file (<filename>.maeidx), followed by the uint64 byte offset of each
+ *        f_m_ct block in the decompressed MAE file and, for GZipped files, the decompression checkpoints
+ */
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    SourceFingerprint source; ///< The fingerprint of the MAE file that was indexed
+    uint64_t n_structures;
+    uint64_t n_checkpoints;
+};
+
+constexpr char INDEX_MAGIC[8] = {'M', 'A', 'E', 'I', 'D', 'X', '\0', '\0'};
+constexpr uint32_t INDEX_VERSION = 2;
+
+/**
+ * @brief A memory-mapped index sidecar file, giving the offset of each structure in an MAE file
+ */
+class StructureIndex {
+public:
+    /**
+     * @brief Opens the index of an MAE file if it exists and is up to date
+     * @param filename Path to the MAE file
+     * @param source The fingerprint of the MAE file
+     * @return The index, or std::nullopt if it is missing, stale or cannot be read
+     */
+    static std::optional<StructureIndex> open(const std::string &filename, const SourceFingerprint &source) {
+        const auto index_filename = filename + ".maeidx";
+
+        if (!std::filesystem::exists(index_filename)) { return std::nullopt; }
+
+        try {
+            StructureIndex index(index_filename);
+
+            const auto &header = index.header();
+            const auto available = index.m_file.size() - sizeof(IndexHeader);
+
+            // the counts are checked against the file size first, so that computing its expected size cannot overflow
+            if (header.n_structures > available / sizeof(uint64_t) ||
+                header.n_checkpoints > available / sizeof(GzipCheckpoint)) {
+                return std::nullopt;
+            }
+
+            const auto expected_size = sizeof(IndexHeader) + header.n_structures * sizeof(uint64_t) +
+                                       header.n_checkpoints * sizeof(GzipCheckpoint);
+
+            if (std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+                header.version != INDEX_VERSION || header.byte_order != binary::BYTE_ORDER_MARK ||
+                !(header.source == source) || index.m_file.size() != expected_size) {
+                return std::nullopt;
+            }
+            return index;
+        } catch (const std::exception &) {
+            return std::nullopt;
+        }
+    }
+
+    size_t size() const { return header().n_structures; }
+
+    /**
+     * @brief The offset of the i-th structure in the decompressed MAE file
+     */
+    uint64_t offset(const size_t i) const {
+        uint64_t value;
+        std::memcpy(&value, m_file.data() + sizeof(IndexHeader) + i * sizeof(uint64_t), sizeof(value));
+        return value;
+    }
+
+    /**
+     * @brief The last decompression checkpoint at or before an offset in a GZipped MAE file
+     * @return The checkpoint, or nullptr if the file is not GZipped
+     */
+    const GzipCheckpoint *find_checkpoint(const uint64_t offset) const {
+        const auto begin = reinterpret_cast<const GzipCheckpoint *>(
+            m_file.data() + sizeof(IndexHeader) + header().n_structures * sizeof(uint64_t));
+        const auto end = begin + header().n_checkpoints;
+
+        const auto next = std::upper_bound(begin, end, offset, [](const uint64_t value, const GzipCheckpoint &c) {
+            return value < c.output;
+        });
+        return next == begin ? nullptr : next - 1;
+    }
+
+    /**
+     * @brief Reads the text of the i-th structure
+     * @param filename Path to the indexed MAE file
+     * @param file_size The size of the MAE file, marking the end of its last structure if uncompressed
+     */
+    std::string read(const std::string &filename, const uint64_t file_size, const size_t i) const {
+        const auto begin = offset(i);
+        const auto has_end = i + 1 < size();
+
+        if (header().n_checkpoints > 0) {
+            const auto end = has_end ? offset(i + 1) : std::numeric_limits<uint64_t>::max();
+            return read_gzip_range(filename, *find_checkpoint(begin), begin, end);
+        }
+
+        const auto end = has_end ? offset(i + 1) : file_size;
+
+        std::ifstream file(filename, std::ios_base::in | std::ios_base::binary);
+        std::string text(end - begin, '\0');
+        file.seekg(static_cast<std::streamoff>(begin));
+        file.read(text.data(), static_cast<std::streamsize>(text.size()));
+
+        if (!file) {
+            throw std::runtime_error("Could not read file: " + filename);
+        }
+        return text;
+    }
+
+private:
+    explicit StructureIndex(const std::string &filename) : m_file(filename) {
+        if (m_file.size() < sizeof(IndexHeader)) {
+            throw std::runtime_error("Invalid index file: " + filename);
+        }
+    }
+
+    const IndexHeader &header() const { return *reinterpret_cast<const IndexHeader *>(m_file.data()); }
+
+    boost::iostreams::mapped_file_source m_file;
+};
+
+/**
+ * @brief Creates or replaces the index sidecar file (<filename>.maeidx) of an MAE file
+ * @details The index stores the offset of each structure, so that read_mae can seek directly to the structures
+ *          it selects rather than scanning the structures before them. For GZipped files it also stores a
+ *          checkpoint roughly every MiB of decompressed data, from which decompression can resume.
+ * @param filename Path to the MAE file to index
+ * @return The number of structures indexed
+ */
+size_t index_mae(const std::string &filename) {
+    nb::gil_scoped_release release;
+
+    const auto source = fingerprint_file(filename);
+
+    std::vector<uint64_t> offsets;
+    std::vector<GzipCheckpoint> checkpoints;
+
+    if (is_gzipped(filename)) {
+        const auto stream = std::make_shared<GzipIndexingStream>(filename);
+        BlockScanner scanner(stream);
+
+        while (const auto block = next_ct_block(scanner)) { offsets.push_back(block->offset); }
+
+        checkpoints = std::move(stream->checkpoints());
+    } else {
+        BlockScanner scanner(filename);
+
+        while (const auto block = next_ct_block(scanner)) { offsets.push_back(block->offset); }
+    }
+
+    IndexHeader header{};
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.byte_order = binary::BYTE_ORDER_MARK;
+    header.source = source;
+    header.n_structures = offsets.size();
+    header.n_checkpoints = checkpoints.size();
+
+    const auto index_filename = filename + ".maeidx";
+    const auto index_temporary_filename = temporary_filename(index_filename);
+
+    {
+        std::ofstream file(index_temporary_filename, std::ios_base::out | std::ios_base::binary);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(offsets.data()),
+                   static_cast<std::streamsize>(offsets.size() * sizeof(uint64_t)));
+        file.write(reinterpret_cast<const char *>(checkpoints.data()),
+                   static_cast<std::streamsize>(checkpoints.size() * sizeof(GzipCheckpoint)));
+
+        if (!file) {
+            std::error_code error;
+            std::filesystem::remove(index_temporary_filename, error);
+
+            throw std::runtime_error("Could not write index file: " + index_filename);
+        }
+    }
+    std::filesystem::rename(index_temporary_filename, index_filename);
+
+    return offsets.size();
+}
+
+/**
+ * @brief Parses a slice of the structures in an MAE file
+ * @details Skipped structures are only scanned for block boundaries rather than parsed. If the file has an
+ *          up to date index (see index_mae), the selected structures are instead read directly from their
+ *          offsets.
+ * @param filename Path to the MAE file to read
+ * @param slice The structures to parse
+ * @return The parsed CT blocks
+ */
+std::vector<std::shared_ptr<schrodinger::mae::Block> > read_blocks(const std::string &filename,
+                                                                   const Slice &slice) {
+    std::vector<std::shared_ptr<schrodinger::mae::Block> > blocks;
+
+    const auto source = fingerprint_file(filename);
+
+    if (const auto index = StructureIndex::open(filename, source)) {
+        for (uint64_t i = slice.start; i < std::min<uint64_t>(slice.stop, index->size()); i += slice.step) {
+            blocks.push_back(parse_raw_block(index->read(filename, source.size, i)));
+        }
+        return blocks;
+    }
+
+    BlockScanner scanner(filename);
+
+    for (uint64_t i = 0; i < slice.stop; ++i) {
+        auto block = next_ct_block(scanner);
+
+        if (!block) { break; }
+        if (slice.contains(i)) { blocks.push_back(parse_raw_block(std::move(block->text))); }
+    }
+
+    return blocks;
+}
+
+/**
+ * @brief Finds the offsets of the structures that validation issues were found in
+ * @details This is only needed once validation has failed, so the offsets are not tracked while reading.
+ * @param filename Path to the MAE file the structures were read from
+ * @param issues The issues, whose offsets are set
+ */
+void locate_issues(const std::string &filename, std::vector<StructureIssue> &issues) {
+    const auto source = fingerprint_file(filename);
+
+    if (const auto index = StructureIndex::open(filename, source)) {
+        for (auto &issue: issues) { issue.offset = index->offset(issue.structure); }
+        return;
+    }
+
+    BlockScanner scanner(filename);
+    auto issue = issues.begin();
+
+    for (size_t i = 0; issue != issues.end(); ++i) {
+        const auto block = next_ct_block(scanner);
+        if (!block) { break; }
+
+        for (; issue != issues.end() && issue->structure == i; ++issue) { issue->offset = block->offset; }
+    }
+}
+
+/**
+ * @brief A thread-safe FIFO queue with a maximum size, used to connect the stages of a pipeline
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(const size_t capacity) : m_capacity(std::max<size_t>(capacity, 1)) {
+    }
+
+    /**
+     * @brief Appends a value, blocking while the queue is full
+     * @return Whether the value was appended, or false if the queue was cancelled
+     */
+    bool push(T value) {
+        std::unique_lock lock(m_mutex);
+        m_not_full.wait(lock, [this] { return m_cancelled || m_values.size() < m_capacity; });
+
+        if (m_cancelled) { return false; }
+
+        m_values.push_back(std::move(value));
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Removes the oldest value, blocking while the queue is empty
+     * @return The value, or std::nullopt once the queue is closed and empty, or cancelled
+     */
+    std::optional<T> pop() {
+        std::unique_lock lock(m_mutex);
+        m_not_empty.wait(lock, [this] { return m_cancelled || m_closed || !m_values.empty(); });
+
+        if (m_cancelled || m_values.empty()) { return std::nullopt; }
+
+        auto value = std::move(m_values.front());
+        m_values.pop_front();
+        m_not_full.notify_one();
+        return value;
+    }
+
+    /**
+     * @brief Marks the end of the values, which are still popped
+     */
+    void close() {
+        std::lock_guard lock(m_mutex);
+        m_closed = true;
+        m_not_empty.notify_all();
+    }
+
+    /**
+     * @brief Discards any values and wakes all waiting threads
+     */
+    void cancel() {
+        std::lock_guard lock(m_mutex);
+        m_cancelled = true;
+        m_values.clear();
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+    }
+
+private:
+    size_t m_capacity;
+    std::deque<T> m_values;
+    bool m_closed = false;
+    bool m_cancelled = false;
+
+    std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+};
+
+/**
+ * @brief A stream buffer which reads chunks of bytes from a queue, blocking until each is available
+ */
+class QueueStreamBuffer : public std::streambuf {
+public:
+    explicit QueueStreamBuffer(BoundedQueue<std::string> &queue) : m_queue(queue) {
+    }
+
+protected:
+    int_type underflow() override {
+        if (gptr() == egptr()) {
+            auto chunk = m_queue.pop();
+
+            if (!chunk) { return traits_type::eof(); }
+
+            m_chunk = std::move(*chunk);
+            setg(m_chunk.data(), m_chunk.data(), m_chunk.data() + m_chunk.size());
+        }
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    BoundedQueue<std::string> &m_queue;
+    std::string m_chunk;
+};
+
+/**
+ * @brief Reads the CT blocks of an MAE file using a pipeline of a decompressor and a parser thread
+ * @details The decompressor thread reads (and if needed decompresses) the file into chunks, which the parser
+ *          thread parses into blocks. The caller converts the blocks as they complete, so that the time to read
+ *          a file approaches that of the slowest stage rather than the sum of all three. Neither thread touches
+ *          Python objects.
+ */
+class BlockPipeline {
+public:
+    /**
+     * @param filename Path to the MAE file to read
+     * @param chunk_queue_depth The maximum number of decompressed 1 MiB chunks waiting to be parsed
+     * @param block_queue_depth The maximum number of parsed blocks waiting to be converted
+     */
+    BlockPipeline(const std::string &filename, const size_t chunk_queue_depth, const size_t block_queue_depth)
+        : m_chunks(chunk_queue_depth), m_blocks(block_queue_depth), m_buffer(m_chunks) {
+        auto stream = open_input_stream(filename);
+
+        m_decompressor = std::thread([this, filename, stream = std::move(stream)] {
+            run(0, [&] {
+                constexpr size_t chunk_size = 1 << 20;
+
+                while (true) {
+                    std::string chunk(chunk_size, '\0');
+                    stream->read(chunk.data(), chunk_size);
+                    chunk.resize(static_cast<size_t>(stream->gcount()));
+
+                    if (chunk.empty()) { break; }
+                    if (!m_chunks.push(std::move(chunk))) { return; }
+                }
+                if (stream->bad()) {
+                    throw std::runtime_error("Could not read file: " + filename);
+                }
+            });
+            m_chunks.close();
+        });
+        m_parser = std::thread([this] {
+            run(1, [&] {
+                schrodinger::mae::Reader reader(std::make_shared<std::istream>(&m_buffer));
+
+                while (auto block = reader.next(schrodinger::mae::CT_BLOCK)) {
+                    if (!m_blocks.push(std::move(block))) { return; }
+                }
+            });
+            m_blocks.close();
+        });
+    }
+
+    ~BlockPipeline() {
+        m_chunks.cancel();
+        m_blocks.cancel();
+
+        m_decompressor.join();
+        m_parser.join();
+    }
+
+    BlockPipeline(const BlockPipeline &) = delete;
+    BlockPipeline &operator=(const BlockPipeline &) = delete;
+
+    /**
+     * @brief Returns the next parsed block, blocking until it is available
+     * @return The block, or nullptr at the end of the file
+     * @throws std::exception The first exception thrown by a stage, once the blocks before it are returned
+     */
+    std::shared_ptr<schrodinger::mae::Block> next() {
+        if (auto block = m_blocks.pop()) { return std::move(*block); }
+
+        std::lock_guard lock(m_mutex);
+
+        for (auto &error: m_errors) {
+            if (error) { std::rethrow_exception(error); }
+        }
+        return nullptr;
+    }
+
+private:
+    /**
+     * @brief Runs the body of a stage, storing any exception it throws
+     */
+    template<typename Body>
+    void run(const size_t stage, Body &&body) {
+        try {
+            body();
+        } catch (...) {
+            std::lock_guard lock(m_mutex);
+            m_errors[stage] = std::current_exception();
+        }
+    }
+
+    BoundedQueue<std::string> m_chunks;
+    BoundedQueue<std::shared_ptr<schrodinger::mae::Block> > m_blocks;
+    QueueStreamBuffer m_buffer;
+
+    std::mutex m_mutex;
+    std::exception_ptr m_errors[2]; ///< The exceptions thrown by the decompressor and parser stages
+
+    std::thread m_decompressor;
+    std::thread m_parser;
+};
+
+/**
+ * @brief Reads an MAE file, skipping any structures which cannot be read rather than failing
+ * @details The file is scanned with a resynchronizing BlockScanner, so a truncated or corrupt CT block ends at
+ *          the next f_m_ct at the start of a line, and each CT block is then parsed on its own.
+ * @param filename Path to the MAE file to read
+ * @param options Options controlling how the file is read, see read_mae. Structures which fail validation are
+ *        also skipped if validation is requested, while caching and pipelining are not supported.
+ * @return The structures which could be read, and why each of the others could not be
+ */
+ReadResult read_mae_skipping_errors(const std::string &filename, const ReadOptions &options) {
+    const auto slice = options.slice();
+
+    BlockScanner scanner(filename, true);
+    ReadResult result;
+    StructureConverter converter(result.structures, options.convert_options(), options.n_threads);
+
+    for (uint64_t i = 0; i < slice.stop; ++i) {
+        std::optional<RawBlock> raw;
+        std::shared_ptr<schrodinger::mae::Block> block;
+        std::vector<std::string> messages;
+        {
+            nb::gil_scoped_release release;
+
+            while ((raw = scanner.next()) && raw->name != schrodinger::mae::CT_BLOCK) {}
+
+            if (!raw) { break; }
+            if (!slice.contains(i)) { continue; }
+
+            try {
+                if (!raw->complete) { throw std::runtime_error("The f_m_ct block has no closing brace"); }
+
+                block = parse_raw_block(std::move(raw->text));
+
+                if (options.validate) { messages = validate_block(*block); }
+            } catch (const std::exception &e) {
+                messages.emplace_back(e.what());
+            }
+        }
+
+        if (!messages.empty()) {
+            for (auto &message: messages) { result.errors.push_back({i, raw->offset, std::move(message)}); }
+            continue;
+        }
+
+        if (options.return_hashes) { result.hashes.push_back(hash_block(*block, options.hash_options())); }
+
+        converter.add(std::move(block));
+    }
+
+    converter.flush();
+    return result;
+}
+
+/**
+ * @brief Reads an MAE file and extracts structure information
+ * @param filename Path to the MAE file to read
+ * @param options Options controlling how the file is read. If a cache is requested, the structures are read
+ *        from a binary cache file alongside the MAE file (<filename>.maebin) when it matches the size,
+ *        modification time and a hash of the MAE file, and the cache is (re-)created otherwise. If only a
+ *        slice of the structures is requested without a cache, the skipped structures are never parsed (see
+ *        read_blocks). If lazy structures are requested, each is returned as a Structure instead. If a
+ *        pipelined read is requested, the file is read using a BlockPipeline. If errors should be skipped,
+ *        the file is read using read_mae_skipping_errors. Structures are converted using a StructureConverter.
+ * @return Python dictionaries, each containing information about a structure (see convert_block), the hash
+ *         of each structure if requested (see hash_block), and the structures skipped if skipping errors
+ */
+ReadResult read_mae(const std::string &filename, const ReadOptions &options) {
+    if (options.step == 0) {
+        throw std::invalid_argument("The slice step must be greater than zero");
+    }
+    if (options.skip_errors) {
+        return read_mae_skipping_errors(filename, options);
+    }
+
+    const auto cache_filename = filename + ".maebin";
+    const auto slice = options.slice();
+
+    std::optional<SourceFingerprint> source;
+
+    if (options.cache) {
+        source = fingerprint_file(filename);
+
+        // cached structures are not parsed, so cannot be validated, and are always converted to lists
+        if (!options.validate && options.convert_options().lists()) {
+            if (auto result = read_mae_cache(cache_filename, *source, options)) { return std::move(*result); }
+        }
+    }
+
+    ReadResult result;
+    StructureConverter converter(result.structures, options.convert_options(), options.n_threads);
+
+    std::vector<StructureIssue> issues;
+
+    const auto check_issues = [&]() {
+        if (issues.empty()) { return; }
+        {
+            nb::gil_scoped_release release;
+            locate_issues(filename, issues);
+        }
+        throw ValidationException(std::move(issues));
+    };
+
+    if (!options.cache && !slice.is_full()) {
+        std::vector<std::shared_ptr<schrodinger::mae::Block> > blocks;
+        {
+            nb::gil_scoped_release release;
+            blocks = read_blocks(filename, slice);
+        }
+
+        for (uint64_t i = 0; i < blocks.size(); ++i) {
+            auto &block = blocks[i];
+
+            if (options.validate) { validate_structure(*block, slice.start + i * slice.step, std::nullopt, issues); }
+
+            if (options.return_hashes) { result.hashes.push_back(hash_block(*block, options.hash_options())); }
+
+            converter.add(std::move(block));
+        }
+
+        check_issues();
+        converter.flush();
+        return result;
+    }
+
+    std::optional<schrodinger::mae::Reader> reader;
+    std::optional<BlockPipeline> pipeline;
+
+    if (options.pipelined) {
+        pipeline.emplace(filename, options.chunk_queue_depth, options.block_queue_depth);
+    } else {
+        reader.emplace(filename);
+    }
+
+    const auto next_block = [&]() -> std::shared_ptr<schrodinger::mae::Block> {
+        if (!pipeline) { return reader->next(schrodinger::mae::CT_BLOCK); }
+
+        nb::gil_scoped_release release;
+        return pipeline->next();
+    };
+
+    ColumnarDataset dataset;
+
+    for (uint64_t i = 0; auto block = next_block(); ++i) {
+        if (options.cache) { dataset.append(*block); }
+
+        if (!slice.contains(i)) { continue; }
+
+        if (options.validate) { validate_structure(*block, i, std::nullopt, issues); }
+
+        if (options.return_hashes) { result.hashes.push_back(hash_block(*block, options.hash_options())); }
+
+        converter.add(std::move(block));
+    }
+
+    check_issues();
+    converter.flush();
+
+    if (options.cache) {
+        dataset.finish();
+        write_mae_cache(cache_filename, dataset, *source);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Computes the hash of each structure in an MAE file without converting them to Python objects
+ * @param filename Path to the MAE file to read
+ * @param coordinates Whether to include the atom coordinates in the hashes
+ * @param display Whether to include display-only properties in the hashes
+ * @return The hash of each structure (see hash_block)
+ */
+std::vector<uint64_t> hash_structures(const std::string &filename, const bool coordinates, const bool display) {
+    nb::gil_scoped_release release;
+
+    const HashOptions options{coordinates, display};
+
+    schrodinger::mae::Reader reader(filename);
+    std::vector<uint64_t> hashes;
+
+    while (const auto block = reader.next(schrodinger::mae::CT_BLOCK)) {
+        hashes.push_back(hash_block(*block, options));
+    }
+
+    return hashes;
+}
+
+
+/**
+ * @brief Checks each structure in an MAE file for problems (see validate_block) without converting them
+ * @param filename Path to the MAE file to check
+ * @return The problems found, in the order of the structures
+ */
+std::vector<StructureIssue> validate_mae(const std::string &filename) {
+    nb::gil_scoped_release release;
+
+    BlockScanner scanner(filename);
+    std::vector<StructureIssue> issues;
+
+    for (size_t i = 0; auto block = next_ct_block(scanner); ++i) {
+        validate_structure(*parse_raw_block(std::move(block->text)), i, block->offset, issues);
+    }
+
+    return issues;
+}
+
+nb::object bitmap_to_numpy(const Bitmap &bitmap, const size_t n) {
+    return bitmap_to_numpy(bitmap.bytes().data(), bitmap.size(), n);
+}
+
+/**
+ * @brief Converts the columns of a table to numpy arrays (or lists for strings), and the undefined values of
+ *        any columns that contain them to numpy bool masks
+ */
+template<typename T>
+void convert_ragged_columns(std::map<std::string, ColumnBuilder<T> > &columns,
+                            const size_t n_rows,
+                            nb::dict &values,
+                            nb::dict &nulls) {
+    for (auto &[name, column]: columns) {
+        if (column.nulls.any()) { nulls[name.c_str()] = bitmap_to_numpy(column.nulls, n_rows); }
+
+        if constexpr (std::is_same_v<T, std::string>) {
+            nb::list strings;
+            for (size_t i = 0; i < n_rows; ++i) {
+                strings.append(column.nulls.test(i) ? nb::none() : nb::cast(column.values[i]));
+            }
+            values[name.c_str()] = strings;
+        } else if constexpr (std::is_same_v<T, uint8_t>) {
+            values[name.c_str()] = to_numpy<bool>(std::move(column.values));
+        } else {
+            values[name.c_str()] = to_numpy<T>(std::move(column.values));
+        }
+        column = ColumnBuilder<T>();
+    }
+}
+
+/**
+ * @brief Converts a finished columnar table to a dictionary of its offsets, columns and null masks
+ */
+nb::dict convert_ragged_table(ColumnarTable &table) {
+    nb::dict values, nulls;
+
+    convert_ragged_columns(table.bools, table.n_rows, values, nulls);
+    convert_ragged_columns(table.ints, table.n_rows, values, nulls);
+    convert_ragged_columns(table.reals, table.n_rows, values, nulls);
+    convert_ragged_columns(table.strings, table.n_rows, values, nulls);
+
+    nb::dict result;
+    result["offsets"] = to_numpy<uint64_t>(std::move(table.offsets));
+    result["present"] = bitmap_to_numpy(table.present, table.n_structures());
+    result["columns"] = values;
+    result["nulls"] = nulls;
+
+    return result;
+}
+
+/**
+ * @brief Reads the structures of an MAE file into tables of contiguous columns spanning every structure
+ * @details The CT properties, atoms and bonds of all structures are each gathered into one table, stored
+ *          column-wise with the rows of each structure stored contiguously, i.e. in a CSR like layout. Numeric
+ *          columns are moved into numpy arrays without copying.
+ * @param filename Path to the MAE file to read
+ * @return A dictionary with props, atoms and bonds tables, each a dictionary of:
+ *         - offsets: The first row of each structure, followed by the number of rows
+ *         - present: Whether each structure contains the table
+ *         - columns: The values of each property, with undefined values set to zero or None
+ *         - nulls: For properties with undefined values, whether each value is undefined
+ */
+nb::dict read_mae_ragged(const std::string &filename) {
+    ColumnarDataset dataset;
+    {
+        nb::gil_scoped_release release;
+
+        schrodinger::mae::Reader reader(filename);
+
+        while (const auto block = reader.next(schrodinger::mae::CT_BLOCK)) { dataset.append(*block); }
+
+        dataset.finish();
+    }
+
+    nb::dict result;
+    result["props"] = convert_ragged_table(dataset.props);
+    result["atoms"] = convert_ragged_table(dataset.atoms);
+    result["bonds"] = convert_ragged_table(dataset.bonds);
+
+    return result;
+}
+
+/**
+ * @brief The bond graphs of one or more structures, with zero-based atom indices
+ * @details When graphs of several structures are appended, the atoms of each are numbered after those of the
+ *          previous structures, i.e. as one disconnected graph, in the layout expected by graph neural network
+ *          loaders.
+ */
+class BondGraph {
+public:
+    /**
+     * @param undirected Whether edge_index should contain each bond in both directions
+     */
+    explicit BondGraph(const bool undirected) : m_undirected(undirected) {
+    }
+
+    /**
+     * @brief Appends the bond graph of a structure
+     * @param n_atoms The number of atoms in the structure
+     * @param from The one-based index of the first atom of each bond (i_m_from)
+     * @param to The one-based index of the second atom of each bond (i_m_to)
+     * @param order The order of each bond (i_m_order), or an empty vector to use single bonds
+     * @throws std::runtime_error If a bond references an atom that does not exist
+     */
+    void append(const size_t n_atoms,
+                const std::vector<int> &from,
+                const std::vector<int> &to,
+                const std::vector<int> &order) {
+        const auto atom_offset = static_cast<int64_t>(m_atom_offsets.back());
+        const auto n_bonds = std::min(from.size(), to.size());
+
+        std::vector<std::pair<int64_t, int64_t> > bonds;
+        std::vector<int32_t> bond_orders;
+        std::unordered_set<uint64_t> seen;
+
+        for (size_t i = 0; i < n_bonds; ++i) {
+            if (from[i] < 1 || to[i] < 1 || static_cast<size_t>(from[i]) > n_atoms ||
+                static_cast<size_t>(to[i]) > n_atoms) {
+                throw std::runtime_error("Bond " + std::to_string(i + 1) + " references an atom that does not exist");
+            }
+
+            // bonds may be listed in one or both directions, so only keep the first of each pair of atoms
+            const auto a = std::min(from[i], to[i]) - 1, b = std::max(from[i], to[i]) - 1;
+            if (!seen.insert(static_cast<uint64_t>(a) * n_atoms + b).second) { continue; }
+
+            bonds.emplace_back(from[i] - 1, to[i] - 1);
+            bond_orders.push_back(i < order.size() ? order[i] : 1);
+        }
+
+        std::vector<int64_t> degrees(n_atoms + 1, 0);
+
+        for (const auto &[a, b]: bonds) {
+            ++degrees[a + 1];
+            ++degrees[b + 1];
+        }
+        for (size_t i = 0; i < n_atoms; ++i) { degrees[i + 1] += degrees[i]; }
+
+        const auto indices_offset = m_indices.size();
+        m_indices.resize(indices_offset + 2 * bonds.size());
+
+        for (const auto &[a, b]: bonds) {
+            m_indices[indices_offset + degrees[a]++] = b + atom_offset;
+            m_indices[indices_offset + degrees[b]++] = a + atom_offset;
+        }
+        for (size_t i = 0; i < n_atoms; ++i) {
+            m_indptr.push_back(static_cast<int64_t>(indices_offset) + degrees[i]);
+        }
+
+        for (size_t i = 0; i < bonds.size(); ++i) {
+            const auto [a, b] = bonds[i];
+
+            m_sources.push_back(a + atom_offset);
+            m_targets.push_back(b + atom_offset);
+            m_orders.push_back(bond_orders[i]);
+
+            if (m_undirected) {
+                m_sources.push_back(b + atom_offset);
+                m_targets.push_back(a + atom_offset);
+                m_orders.push_back(bond_orders[i]);
+            }
+        }
+
+        m_atom_offsets.push_back(m_atom_offsets.back() + n_atoms);
+        m_edge_offsets.push_back(m_sources.size());
+    }
+
+    /**
+     * @brief Appends the bond graph of a parsed CT block
+     */
+    void append(const schrodinger::mae::Block &block) {
+        const auto atoms = get_indexed_block(block, schrodinger::mae::ATOM_BLOCK);
+        const auto bonds = get_indexed_block(block, schrodinger::mae::BOND_BLOCK);
+
+        append(atoms ? atoms->size() : 0, bonds.get());
+    }
+
+    /**
+     * @brief Appends the bond graph of a structure with n_atoms atoms and the given bond block, if any
+     */
+    void append(const size_t n_atoms, const schrodinger::mae::IndexedBlock *bonds) {
+        const auto column = [&bonds](const char *name, const bool required) {
+            std::vector<int> values;
+
+            const auto &props = bonds->getProperties<int>();
+            const auto property = props.find(name);
+
+            if (property == props.end()) {
+                if (required) { throw std::runtime_error(std::string("The bonds have no ") + name + " property"); }
+                return values;
+            }
+
+            values.resize(bonds->size(), 1);
+
+            for (size_t i = 0; i < bonds->size(); ++i) {
+                if (property->second->isDefined(i)) {
+                    values[i] = property->second->at(i);
+                } else if (required) {
+                    throw std::runtime_error("Bond " + std::to_string(i + 1) + " has an undefined " + name);
+                }
+            }
+            return values;
+        };
+
+        if (!bonds || bonds->size() == 0) {
+            append(n_atoms, {}, {}, {});
+        } else {
+            append(n_atoms, column("i_m_from", true), column("i_m_to", true), column("i_m_order", false));
+        }
+    }
+
+    /**
+     * @brief Converts the graph to a dictionary of numpy arrays, leaving it empty
+     * @return A dictionary containing:
+     *         - edge_index: A (2, E) int64 array of the source and target atoms of each edge
+     *         - order: An int32 array of the bond order of each edge
+     *         - indptr, indices: The neighbors of each atom in CSR form, i.e. the neighbors of atom i are
+     *           indices[indptr[i]:indptr[i + 1]]
+     *         - atom_offsets, edge_offsets: The first atom and edge of each structure, followed by their totals
+     */
+    nb::dict to_numpy() {
+        std::vector<int64_t> edge_index(std::move(m_sources));
+        edge_index.insert(edge_index.end(), m_targets.begin(), m_targets.end());
+
+        nb::dict graph;
+        graph["edge_index"] = ::to_numpy(std::move(edge_index), 2);
+        graph["order"] = ::to_numpy<int32_t>(std::move(m_orders));
+        graph["indptr"] = ::to_numpy<int64_t>(std::move(m_indptr));
+        graph["indices"] = ::to_numpy<int64_t>(std::move(m_indices));
+        graph["atom_offsets"] = ::to_numpy<uint64_t>(std::move(m_atom_offsets));
+        graph["edge_offsets"] = ::to_numpy<uint64_t>(std::move(m_edge_offsets));
+
+        return graph;
+    }
+
+private:
+    bool m_undirected;
+
+    std::vector<int64_t> m_sources, m_targets;
+    std::vector<int32_t> m_orders;
+    std::vector<int64_t> m_indptr{0}, m_indices;
+    std::vector<uint64_t> m_atom_offsets{0}, m_edge_offsets{0};
+};
+
+void add_indexed_properties_to_block(std::shared_ptr<schrodinger::mae::IndexedBlock> &block,
+                                     const nb::dict &props);
+
+/**
+ * @brief Computes the bond graph of a structure
+ * @param atoms The atom properties of the structure (see create_block)
+ * @param bonds The bond properties of the structure (see create_block)
+ * @param undirected Whether edge_index should contain each bond in both directions
+ * @return The bond graph (see BondGraph::to_numpy)
+ */
+nb::dict bond_graph(const nb::dict &atoms, const nb::dict &bonds, const bool undirected) {
+    BondGraph graph(undirected);
+
+    size_t n_atoms = 0;
+    for (const auto &item: atoms) {
+        n_atoms = indexed_column_size(item.second);
+        break;
+    }
+
+    if (nb::len(bonds) > 0 && (!bonds.contains("i_m_from") || !bonds.contains("i_m_to"))) {
+        throw std::runtime_error("The bonds must have i_m_from and i_m_to properties");
+    }
+
+    // the columns may be in any of the forms accepted by write_mae, e.g. (array, mask) tuples
+    nb::dict columns;
+    for (const char *name: {"i_m_from", "i_m_to", "i_m_order"}) {
+        if (bonds.contains(name)) { columns[name] = bonds[name]; }
+    }
+
+    auto block = std::make_shared<schrodinger::mae::IndexedBlock>(schrodinger::mae::BOND_BLOCK);
+    add_indexed_properties_to_block(block, columns);
+
+    graph.append(n_atoms, block.get());
+    return graph.to_numpy();
+}
+
+/**
+ * @brief Reads the bond graphs of every structure in an MAE file as one batched graph, without converting the
+ *        structures to Python objects
+ * @param filename Path to the MAE file to read
+ * @param undirected Whether edge_index should contain each bond in both directions
+ * @return The batched bond graph (see BondGraph::to_numpy)
+ */
+nb::dict read_mae_graphs(const std::string &filename, const bool undirected) {
+    BondGraph graph(undirected);
+    {
+        nb::gil_scoped_release release;
+
+        schrodinger::mae::Reader reader(filename);
+
+        while (const auto block = reader.next(schrodinger::mae::CT_BLOCK)) { graph.append(*block); }
+    }
+    return graph.to_numpy();
+}
+
+/**
+ * @brief A binary MAE image (see binary::BinaryWriter) of an MAE file stored in POSIX shared memory
+ * @details The image is created once and can then be attached to by name from any process, e.g. the workers of
+ *          a data loader, which read it through read-only zero-copy views rather than each parsing the file.
+ */
+class SharedDataset {
+public:
+    /**
+     * @brief Parses an MAE file into a new shared memory segment
+     * @param filename Path to the MAE file to read
+     * @param name The name of the shared memory segment to create, which must not already exist
+     * @return The dataset, attached to the new segment
+     */
+    static SharedDataset create(const std::string &filename, const std::string &name) {
+        namespace ipc = boost::interprocess;
+
+        binary::BinaryWriter writer;
+        {
+            nb::gil_scoped_release release;
+
+            schrodinger::mae::Reader reader(filename);
+            ColumnarDataset dataset;
+
+            while (const auto block = reader.next(schrodinger::mae::CT_BLOCK)) { dataset.append(*block); }
+
+            dataset.finish();
+            writer.append(dataset, fingerprint_file(filename));
+        }
+
+        ipc::shared_memory_object memory(ipc::create_only, name.c_str(), ipc::read_write);
+
+        try {
+            memory.truncate(static_cast<ipc::offset_t>(writer.buffer().size()));
+            {
+                const ipc::mapped_region region(memory, ipc::read_write);
+                std::memcpy(region.get_address(), writer.buffer().data(), writer.buffer().size());
+            }
+            return attach(name);
+        } catch (...) {
+            ipc::shared_memory_object::remove(name.c_str());
+            throw;
+        }
+    }
+
+    /**
+     * @brief Attaches to an existing shared memory segment created by create
+     * @throws std::runtime_error If the segment does not contain a dataset this module can read
+     */
+    static SharedDataset attach(const std::string &name) {
+        namespace ipc = boost::interprocess;
+
+        const ipc::shared_memory_object memory(ipc::open_only, name.c_str(), ipc::read_only);
+        return SharedDataset(name, ipc::mapped_region(memory, ipc::read_only));
+    }
+
+    /**
+     * @brief Removes the shared memory segment. Attached datasets remain valid until they are destroyed.
+     */
+    void unlink() const { boost::interprocess::shared_memory_object::remove(m_name.c_str()); }
+
+    const std::string &name() const { return m_name; }
+
+    size_t size() const { return m_n_structures; }
+
+    /**
+     * @brief Converts a structure to a dictionary, in the same format as returned by convert_block
+     */
+    nb::dict get(const size_t structure) const {
+        if (structure >= m_n_structures) { throw nb::index_error("structure index out of range"); }
+
+        const Slice slice{structure, structure + 1, 1};
+        return binary::convert_binary(m_tables[0], m_tables[1], m_tables[2], m_n_structures, slice)[0];
+    }
+
+    /**
+     * @brief Returns read-only views of a table, in the same format as returned by read_mae_ragged
+     * @details The offsets and the bool, int and real columns are zero-copy numpy views of the shared memory,
+     *          while string columns and bitmaps are converted.
+     * @param name The name of the table, one of props, atoms or bonds
+     * @param owner The Python object of this dataset, which is kept alive by the views
+     */
+    nb::dict table(const std::string &name, const nb::handle owner) const {
+        const auto &table = m_tables[table_index(name)];
+
+        nb::dict values, nulls;
+
+        for (const auto &column: table.columns) {
+            if (column.nulls) { nulls[column.key] = bitmap_to_numpy(column.nulls, table.n_rows, table.n_rows); }
+
+            switch (column.type) {
+                case ColumnType::Bool:
+                    values[column.key] = view<bool>(column.values, table.n_rows, owner);
+                    break;
+                case ColumnType::Int:
+                    values[column.key] = view<int32_t>(column.values, table.n_rows, owner);
+                    break;
+                case ColumnType::Real:
+                    values[column.key] = view<double>(column.values, table.n_rows, owner);
+                    break;
+                default: {
+                    nb::list strings;
+                    for (uint64_t row = 0; row < table.n_rows; ++row) { strings.append(column.value(row)); }
+                    values[column.key] = strings;
+                }
+            }
+        }
+
+        nb::dict result;
+        result["offsets"] = view<uint64_t>(table.offsets, m_n_structures + 1, owner);
+        result["present"] = bitmap_to_numpy(table.present, m_n_structures, m_n_structures);
+        result["columns"] = values;
+        result["nulls"] = nulls;
+
+        return result;
+    }
+
+private:
+    SharedDataset(std::string name, boost::interprocess::mapped_region region)
+        : m_name(std::move(name)), m_region(std::move(region)) {
+        const binary::BinaryView view(static_cast<const char *>(m_region.get_address()), m_region.get_size());
+
+        if (!view.is_valid()) {
+            throw std::runtime_error("The shared memory segment does not contain an MAE dataset: " + m_name);
+        }
+
+        m_n_structures = view.header().n_structures;
+
+        for (const auto offset: view.header().tables) { m_tables.emplace_back(view, offset, m_n_structures); }
+    }
+
+    static size_t table_index(const std::string &name) {
+        if (name == "props") { return 0; }
+        if (name == "atoms") { return 1; }
+        if (name == "bonds") { return 2; }
+
+        throw nb::key_error(name.c_str());
+    }
+
+    template<typename T>
+    static nb::object view(const void *data, const size_t size, const nb::handle owner) {
+        return nb::cast(nb::ndarray<nb::numpy, const T, nb::ndim<1> >(data, {size}, owner));
+    }
+
+    std::string m_name;
+    boost::interprocess::mapped_region m_region;
+
+    uint64_t m_n_structures = 0;
+    std::vector<binary::TableView> m_tables;
+};
+
+/**
+ * @brief Random access to the structures of an MAE file through its index (see index_mae)
+ * @details Each access reads and parses a single structure, starting from its offset or, for GZipped files,
+ *          from the last decompression checkpoint preceding it. Recently parsed structures are kept in an LRU
+ *          cache, so that repeated accesses are not parsed again.
+ */
+class MaeDataset {
+public:
+    /**
+     * @param filename Path to the MAE or GZipped MAE file, which is indexed if it has no up to date index
+     * @param cache_size The maximum number of parsed structures to cache
+     * @param lazy Whether to return Structure objects rather than dictionaries
+     */
+    MaeDataset(std::string filename, const size_t cache_size, const bool lazy)
+        : m_filename(std::move(filename)), m_source(fingerprint_file(m_filename)),
+          m_index(open_index(m_filename, m_source)), m_cache_size(cache_size), m_options{lazy} {
+    }
+
+    const std::string &filename() const { return m_filename; }
+
+    size_t cache_size() const { return m_cache_size; }
+
+    bool lazy() const { return m_options.lazy; }
+
+    size_t size() const { return m_index.size(); }
+
+    /**
+     * @brief Parses a structure, or returns it from the cache, and converts it (see convert_structure)
+     */
+    nb::object get(const size_t structure) {
+        if (structure >= size()) { throw nb::index_error("structure index out of range"); }
+
+        if (const auto cached = m_cached.find(structure); cached != m_cached.end()) {
+            m_recent.splice(m_recent.begin(), m_recent, cached->second);
+            return convert_structure(cached->second->second, m_options, m_schema);
+        }
+
+        std::shared_ptr<schrodinger::mae::Block> block;
+        {
+            nb::gil_scoped_release release;
+            block = parse_raw_block(m_index.read(m_filename, m_source.size, structure));
+        }
+
+        // another thread may have cached the structure while the GIL (or the lock on this dataset) was released
+        if (m_cache_size > 0 && m_cached.find(structure) == m_cached.end()) {
+            m_recent.emplace_front(structure, block);
+            m_cached[structure] = m_recent.begin();
+
+            if (m_recent.size() > m_cache_size) {
+                m_cached.erase(m_recent.back().first);
+                m_recent.pop_back();
+            }
+        }
+
+        return convert_structure(std::move(block), m_options, m_schema);
+    }
+
+private:
+    static StructureIndex open_index(const std::string &filename, const SourceFingerprint &source) {
+        if (auto index = StructureIndex::open(filename, source)) { return *std::move(index); }
+
+        index_mae(filename);
+
+        if (auto index = StructureIndex::open(filename, source)) { return *std::move(index); }
+
+        throw std::runtime_error("Could not index file: " + filename);
+    }
+
+    using CacheEntry = std::pair<size_t, std::shared_ptr<schrodinger::mae::Block> >;
+
+    std::string m_filename;
+    SourceFingerprint m_source;
+    StructureIndex m_index;
+
+    size_t m_cache_size;
+    ConvertOptions m_options;
+
+    std::list<CacheEntry> m_recent; ///< The cached structures, most recently used first
+    std::unordered_map<size_t, std::list<CacheEntry>::iterator> m_cached;
+
+    StructureSchema m_schema;
+};
+
+/**
+ * @brief Adds all properties from a Python dictionary to a MAE block
+ * @param block The MAE block to add properties to
+ * @param props The Python dictionary containing properties
+ * @throws std::runtime_error If a property has an unsupported type
+ */
+void add_properties_to_block(const std::shared_ptr<schrodinger::mae::Block> &block, const nb::dict &props) {
+    for (const auto &item: props) {
+        auto key = nb::cast<std::string>(item.first);
+        nb::handle value = item.second;
+
+        if (key.compare(0, 2, "i_") == 0) {
+            block->setIntProperty(key, nb::cast<int>(value));
+        } else if (key.compare(0, 2, "r_") == 0) {
+            block->setRealProperty(key, nb::cast<double>(value));
+        } else if (key.compare(0, 2, "s_") == 0) {
+            block->setStringProperty(key, nb::cast<std::string>(value));
+        } else if (key.compare(0, 2, "b_") == 0) {
+            block->setBoolProperty(key, nb::cast<uint8_t>(value));
+        } else {
+            throw std::runtime_error("Unsupported property type for key: " + key);
+        }
+    }
+}
+
+/**
+ * @brief Creates an indexed property from a dense column of values and an optional mask of undefined values
+ * @tparam T The type of property (uint8_t, int, double, or std::string)
+ * @param values The values, as a 1D numpy array (or a sequence of strings for std::string), with an arbitrary value
+ *        wherever undefined
+ * @param nulls The undefined values, as a 1D numpy bool array, or None if all values are defined
+ * @param block_size The size of the block
+ * @throws std::runtime_error If either column does not have one value per row of the block
+ */
+template<typename T>
+std::shared_ptr<schrodinger::mae::IndexedProperty<T> > create_property_from_array(const nb::handle &values,
+                                                                                  const nb::handle &nulls,
+                                                                                  const size_t block_size) {
+    std::unique_ptr<boost::dynamic_bitset<> > m_is_null;
+
+    if (!nulls.is_none()) {
+        const auto null_array = nb::cast<NumpyColumn<bool> >(nulls);
+
+        if (null_array.shape(0) != block_size) {
+            throw std::runtime_error("The null mask does not have one value per row");
+        }
+
+        const auto *is_null = static_cast<const bool *>(null_array.data());
+        m_is_null = std::make_unique<boost::dynamic_bitset<> >(block_size);
+
+        for (size_t i = 0; i < block_size; ++i) {
+            if (is_null[i]) { m_is_null->set(i); }
+        }
+    }
+
+    std::vector<T> m_values;
+
+    if constexpr (std::is_same_v<T, std::string>) {
+        if (nb::len(values) != block_size) {
+            throw std::runtime_error("The column does not have one value per row");
+        }
+
+        m_values.resize(block_size);
+        for (size_t i = 0; i < block_size; ++i) {
+            if (!m_is_null || !m_is_null->test(i)) { m_values[i] = nb::cast<std::string>(values[i]); }
+        }
+    } else {
+        using V = std::conditional_t<std::is_same_v<T, uint8_t>, bool,
+            std::conditional_t<std::is_same_v<T, int>, int32_t, T> >;
+
+        const auto value_array = nb::cast<NumpyColumn<V> >(values);
+
+        if (value_array.shape(0) != block_size) {
+            throw std::runtime_error("The column does not have one value per row");
+        }
+
+        const auto *data = static_cast<const V *>(value_array.data());
+        m_values.assign(data, data + block_size);
+    }
+
+    return std::make_shared<schrodinger::mae::IndexedProperty<T> >(m_values, m_is_null.release());
+}
+
+/**
+ * @brief Creates an indexed property in a MAE block from a column of values
+ * @tparam T The type of property (uint8_t, int, double, or std::string)
+ * @param name The name of the property
+ * @param column Python list containing the property values, with None for undefined values, a dense column of
+ *        values (see create_property_from_array), a tuple of a dense column and a mask of undefined values, or for
+ *        b_ properties a PackedBits
+ * @param block_size The size of the block
+ * @param block The MAE indexed block to add the property to
+ */
+template<typename T>
+void create_indexed_property(
+    const std::string &name,
+    const nb::handle &column,
+    const size_t block_size,
+    std::shared_ptr<schrodinger::mae::IndexedBlock> &block
+) {
+    if constexpr (std::is_same_v<T, uint8_t>) {
+        if (nb::isinstance<PackedBits>(column)) {
+            block->setProperty(name, nb::cast<const PackedBits &>(column).to_property());
+            return;
+        }
+    }
+    if (nb::isinstance<nb::tuple>(column)) {
+        const auto pair = nb::cast<nb::tuple>(column);
+        block->setProperty(name, create_property_from_array<T>(pair[0], pair[1], block_size));
+        return;
+    }
+    if (!nb::isinstance<nb::list>(column)) {
+        block->setProperty(name, create_property_from_array<T>(column, nb::none(), block_size));
+        return;
+    }
+
+    const auto values = nb::cast<nb::list>(column);
+
+    std::vector<T> m_values(block_size);
+    // only allocated once an undefined value is found, as a null bitset of nullptr means every value is defined
+    std::unique_ptr<boost::dynamic_bitset<> > m_is_null;
+
+    for (size_t i = 0; i < block_size; ++i) {
+        if (static_cast<Py_ssize_t>(i) >= PyList_GET_SIZE(values.ptr())) {
+            throw std::runtime_error("The " + name + " column was modified while it was being written");
+        }
+        const auto value = nb::borrow(PyList_GET_ITEM(values.ptr(), static_cast<Py_ssize_t>(i)));
+
+        if (value.is_none()) {
+            if (!m_is_null) { m_is_null = std::make_unique<boost::dynamic_bitset<> >(block_size); }
+            m_is_null->set(i);
+        } else {
+            m_values[i] = nb::cast<T>(value);
+        }
+    }
+
+    auto property = std::make_shared<schrodinger::mae::IndexedProperty<T> >(m_values, m_is_null.release());
+    block->setProperty(name, property);
+}
+
+/**
+ * @brief Adds indexed properties from a Python dictionary to a MAE indexed block
+ * @param block The MAE indexed block to add properties to
+ * @param props The Python dictionary containing properties
+ * @throws std::runtime_error If property lists have inconsistent sizes or if a property has an unsupported type
+ */
+void add_indexed_properties_to_block(std::shared_ptr<schrodinger::mae::IndexedBlock> &block,
+                                     const nb::dict &props) {
+    size_t block_size = 0;
+
+    for (const auto &item: props) {
+        block_size = indexed_column_size(item.second);
+        break;
+    }
+
+    if (block_size == 0) { return; }
+
+    for (const auto &item: props) {
+        auto key = nb::cast<std::string>(item.first);
+        const auto values = item.second;
+
+        if (indexed_column_size(values) != block_size) {
+            throw std::runtime_error("Inconsistent property list sizes for key: " + key);
+        }
+
+        if (key.compare(0, 2, "i_") == 0) {
+            create_indexed_property<int>(key, values, block_size, block);
+        } else if (key.compare(0, 2, "r_") == 0) {
+            create_indexed_property<double>(key, values, block_size, block);
+        } else if (key.compare(0, 2, "s_") == 0) {
+            create_indexed_property<std::string>(key, values, block_size, block);
+        } else if (key.compare(0, 2, "b_") == 0) {
+            create_indexed_property<uint8_t>(key, values, block_size, block);
+        } else {
+            throw std::runtime_error("Unsupported property type for key: " + key);
+        }
+    }
+}
+
+/**
+ * @brief Appends a string value to an MAE buffer, quoting and escaping it if required
+ * @param out The buffer to append to
+ * @param value The string value
+ */
+void append_mae_string(std::string &out, const std::string &value) {
+    const bool needs_quotes = value.empty() ||
+                              value.find_first_of(" \t\r\n\"\\") != std::string::npos ||
+                              std::string("<{}#:").find(value.front()) != std::string::npos;
+    if (!needs_quotes) {
+        out += value;
+        return;
+    }
+
+    out += '"';
+    for (const auto c: value) {
+        if (c == '"' || c == '\\') { out += '\\'; }
+        out += c;
+    }
+    out += '"';
+}
+
+/**
+ * @brief Formats MAE blocks as text using std::to_chars rather than iostreams
+ * @details Real values are either written using the shortest representation which round-trips exactly, or
+ *          with a fixed number of decimal places for properties matching a user provided glob pattern. The
+ *          layout of the output mirrors that of Block::write, including any indexed blocks and sub-blocks
+ *          other than the atoms and bonds.
+ */
+class BlockFormatter {
+public:
+    /**
+     * @param precisions Pairs of property name glob patterns and the number of decimal places to write
+     *        matching real properties with. The first matching pattern is used, and real properties which do
+     *        not match any pattern are written using their shortest round-trip representation.
+     */
+    explicit BlockFormatter(std::vector<std::pair<std::string, int> > precisions)
+        : m_precisions(std::move(precisions)) {
+    }
+
+    /**
+     * @brief Formats a CT block, including all of its indexed blocks and sub-blocks, appending it to a buffer
+     * @param block The block to format
+     * @param out The buffer to append to
+     */
+    void format(const schrodinger::mae::Block &block, std::string &out) const {
+        format_block(block, "", out);
+        out += '\n';
+    }
+
+private:
+    template<typename T>
+    using Column = std::pair<const schrodinger::mae::IndexedProperty<T> *, int>;
+
+    int precision(const std::string &name) const {
+        for (const auto &[pattern, decimals]: m_precisions) {
+            if (glob_match(pattern, name)) { return decimals; }
+        }
+        return -1;
+    }
+
+    template<typename T>
+    static void append_names(std::string &out,
+                             const std::string &indentation,
+                             const std::map<std::string, T> &props) {
+        for (const auto &[key, value]: props) {
+            out += indentation;
+            out += key;
+            out += '\n';
+        }
+    }
+
+    template<typename T>
+    void append_values(std::string &out,
+                       const std::string &indentation,
+                       const std::map<std::string, T> &props) const {
+        for (const auto &[key, value]: props) {
+            out += indentation;
+            append_value(out, value, std::is_same_v<T, double> ? precision(key) : -1);
+            out += '\n';
+        }
+    }
+
+    void format_block(const schrodinger::mae::Block &block, const std::string &indentation, std::string &out) const {
+        const auto inner = indentation + "  ";
+
+        out += indentation;
+        out += block.getName();
+        out += " {\n";
+
+        // as in Block::write, the ::: separator is only written if the block has properties
+        if (!block.getProperties<uint8_t>().empty() || !block.getProperties<double>().empty() ||
+            !block.getProperties<int>().empty() || !block.getProperties<std::string>().empty()) {
+            append_names(out, inner, block.getProperties<uint8_t>());
+            append_names(out, inner, block.getProperties<double>());
+            append_names(out, inner, block.getProperties<int>());
+            append_names(out, inner, block.getProperties<std::string>());
+            out += inner;
+            out += ":::\n";
+
+            append_values(out, inner, block.getProperties<uint8_t>());
+            append_values(out, inner, block.getProperties<double>());
+            append_values(out, inner, block.getProperties<int>());
+            append_values(out, inner, block.getProperties<std::string>());
+        }
+
+        for (const auto &name: block.getIndexedBlockNames()) {
+            format_indexed_block(name, *block.getIndexedBlock(name), inner, out);
+        }
+        for (const auto &name: block.getBlockNames()) { format_block(*block.getBlock(name), inner, out); }
+
+        out += indentation;
+        out += "}\n";
+    }
+
+    template<typename T>
+    static void append_value(std::string &out, const T &value, const int decimals) {
+        if constexpr (std::is_same_v<T, std::string>) {
+            append_mae_string(out, value);
+        } else {
+            char buffer[64];
+            std::to_chars_result result{};
+
+            if constexpr (std::is_same_v<T, double>) {
+                result = decimals < 0
+                             ? std::to_chars(buffer, buffer + sizeof(buffer), value)
+                             : std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed, decimals);
+            } else {
+                result = std::to_chars(buffer, buffer + sizeof(buffer), static_cast<int>(value));
+            }
+            if (result.ec != std::errc()) {
+                throw std::runtime_error("Could not format value as text");
+            }
+            out.append(buffer, result.ptr);
+        }
+    }
+
+    template<typename T>
+    std::vector<Column<T> > columns(const schrodinger::mae::IndexedBlock &block) const {
+        std::vector<Column<T> > result;
+        for (const auto &[key, value]: block.getProperties<T>()) {
+            result.emplace_back(value.get(), std::is_same_v<T, double> ? precision(key) : -1);
+        }
+        return result;
+    }
+
+    template<typename T>
+    static void append_row(std::string &out, const std::vector<Column<T> > &columns, const size_t i) {
+        for (const auto &[property, decimals]: columns) {
+            out += ' ';
+            if (property->isDefined(i)) {
+                append_value(out, property->at(i), decimals);
+            } else {
+                out += "<>";
+            }
+        }
+    }
+
+    void format_indexed_block(const std::string &name,
+                              const schrodinger::mae::IndexedBlock &block,
+                              const std::string &indentation,
+                              std::string &out) const {
+        const auto size = block.size();
+        const auto inner = indentation + "  ";
+
+        out += indentation;
+        out += name;
+        out += '[';
+        out += std::to_string(size);
+        out += "] {\n";
+        out += inner;
+        out += "# First column is Index #\n";
+
+        append_names(out, inner, block.getProperties<uint8_t>());
+        append_names(out, inner, block.getProperties<double>());
+        append_names(out, inner, block.getProperties<int>());
+        append_names(out, inner, block.getProperties<std::string>());
+        out += inner;
+        out += ":::\n";
+
+        const auto bool_columns = columns<uint8_t>(block);
+        const auto real_columns = columns<double>(block);
+        const auto int_columns = columns<int>(block);
+        const auto string_columns = columns<std::string>(block);
+
+        for (size_t i = 0; i < size; ++i) {
+            out += inner;
+            append_value(out, static_cast<int>(i + 1), -1);
+            append_row(out, bool_columns, i);
+            append_row(out, real_columns, i);
+            append_row(out, int_columns, i);
+            append_row(out, string_columns, i);
+            out += '\n';
+        }
+
+        out += inner;
+        out += ":::\n";
+        out += indentation;
+        out += "}\n";
+    }
+
+    std::vector<std::pair<std::string, int> > m_precisions;
+};
+
+/**
+ * @brief Formats a CT block as text
+ * @param block The block to format
+ * @param formatter The formatter to use, or nullptr to use maeparser's Block::write
+ * @return The formatted block
+ */
+std::string format_block(const schrodinger::mae::Block &block, const BlockFormatter *formatter) {
+    if (formatter) {
+        std::string buffer;
+        formatter->format(block, buffer);
+        return buffer;
+    }
+
+    std::ostringstream stream;
+    block.write(stream);
+    return stream.str();
+}
+
+/**
+ * @brief Formats MAE blocks on a pool of worker threads and appends them to a stream in submission order
+ * @details Blocks are formatted into per-structure buffers using Block::write by the workers, and the
+ *          buffers are appended to the stream by a single committer thread in the order the blocks were
+ *          submitted, so the output is byte-identical to writing the blocks serially. None of the threads
+ *          touch Python objects, so the GIL does not need to be held while waiting on the writer.
+ */
+class ParallelBlockWriter {
+public:
+    /**
+     * @param stream The stream to append the formatted blocks to
+     * @param n_threads The number of worker threads to format blocks on
+     * @param formatter The formatter to format blocks with, or nullptr to use maeparser's Block::write
+     */
+    ParallelBlockWriter(std::shared_ptr<std::ostream> stream,
+                        const size_t n_threads,
+                        std::shared_ptr<const BlockFormatter> formatter)
+        : m_stream(std::move(stream)), m_formatter(std::move(formatter)), m_max_in_flight(4 * n_threads) {
+        for (size_t i = 0; i < n_threads; ++i) {
+            m_workers.emplace_back(&ParallelBlockWriter::format_blocks, this);
+        }
+        m_committer = std::thread(&ParallelBlockWriter::commit_blocks, this);
+    }
+
+    ~ParallelBlockWriter() { stop(); }
+
+    ParallelBlockWriter(const ParallelBlockWriter &) = delete;
+    ParallelBlockWriter &operator=(const ParallelBlockWriter &) = delete;
+
+    /**
+     * @brief Queues a block to be formatted, blocking while too many blocks are waiting to be committed
+     * @param block The block to write
+     */
+    void write(std::shared_ptr<schrodinger::mae::Block> block) {
+        std::unique_lock lock(m_mutex);
+        m_space_available.wait(lock, [this] { return m_n_submitted - m_n_committed < m_max_in_flight || m_error; });
+
+        if (m_error) { return; }
+
+        m_jobs.emplace_back(m_n_submitted++, std::move(block));
+        m_job_available.notify_one();
+    }
+
+    /**
+     * @brief Waits for all queued blocks to be written and stops the worker threads
+     * @throws std::exception Any exception raised while formatting or writing a block
+     */
+    void close() {
+        stop();
+
+        if (m_error) { std::rethrow_exception(m_error); }
+    }
+
+private:
+    void stop() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_closed = true;
+        }
+        m_job_available.notify_all();
+        m_result_available.notify_all();
+
+        for (auto &worker: m_workers) {
+            if (worker.joinable()) { worker.join(); }
+        }
+        if (m_committer.joinable()) { m_committer.join(); }
+    }
+
+    void set_error(std::exception_ptr error) {
+        {
+            std::lock_guard lock(m_mutex);
+            if (!m_error) { m_error = std::move(error); }
+        }
+        m_job_available.notify_all();
+        m_result_available.notify_all();
+        m_space_available.notify_all();
+    }
+
+    void format_blocks() {
+        while (true) {
+            std::pair<size_t, std::shared_ptr<schrodinger::mae::Block> > job;
+            {
+                std::unique_lock lock(m_mutex);
+                m_job_available.wait(lock, [this] { return !m_jobs.empty() || m_closed || m_error; });
+
+                if (m_jobs.empty() || m_error) { return; }
+
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+
+            std::string buffer;
+            try {
+                buffer = format_block(*job.second, m_formatter.get());
+            } catch (...) {
+                set_error(std::current_exception());
+                return;
+            }
+            job.second.reset();
+
+            {
+                std::lock_guard lock(m_mutex);
+                m_results.emplace(job.first, std::move(buffer));
+            }
+            m_result_available.notify_one();
+        }
+    }
+
+    void commit_blocks() {
+        std::unique_lock lock(m_mutex);
+
+        while (true) {
+            m_result_available.wait(lock, [this] {
+                return m_results.count(m_n_committed) > 0 || (m_closed && m_n_committed == m_n_submitted) || m_error;
+            });
+
+            const auto result = m_results.find(m_n_committed);
+
+            if (m_error || result == m_results.end()) { return; }
+
+            const auto buffer = std::move(result->second);
+            m_results.erase(result);
+
+            lock.unlock();
+            m_stream->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            lock.lock();
+
+            if (!*m_stream) {
+                lock.unlock();
+                set_error(std::make_exception_ptr(std::runtime_error("Failed to write to the MAE file")));
+                return;
+            }
+
+            ++m_n_committed;
+            m_space_available.notify_one();
+        }
+    }
+
+    std::shared_ptr<std::ostream> m_stream;
+    std::shared_ptr<const BlockFormatter> m_formatter;
+    const size_t m_max_in_flight;
+
+    std::mutex m_mutex;
+    std::condition_variable m_job_available;
+    std::condition_variable m_result_available;
+    std::condition_variable m_space_available;
+
+    std::deque<std::pair<size_t, std::shared_ptr<schrodinger::mae::Block> > > m_jobs;
+    std::map<size_t, std::string> m_results;
+
+    size_t m_n_submitted = 0;
+    size_t m_n_committed = 0;
+    bool m_closed = false;
+    std::exception_ptr m_error;
+
+    std::vector<std::thread> m_workers;
+    std::thread m_committer;
+};
+
+/**
+ * @brief Creates an MAE CT block from a Python structure dictionary
+ * @param structure Dictionary containing structure information:
+ *        - title: Structure title (optional)
+ *        - props: Dictionary of structure properties (optional)
+ *        - atoms: Dictionary of atom properties (optional)
+ *        - bonds: Dictionary of bond properties (optional)
+ * @return The created CT block
+ */
+std::shared_ptr<schrodinger::mae::Block> create_block(const nb::dict &structure) {
+    auto block = std::make_shared<schrodinger::mae::Block>(schrodinger::mae::CT_BLOCK);
+    auto block_map = std::make_shared<schrodinger::mae::IndexedBlockMap>();
+
+    if (structure.contains("title")) {
+        const auto title = nb::cast<std::string>(structure["title"]);
+        block->setStringProperty(schrodinger::mae::CT_TITLE, title);
+    }
+    if (structure.contains("props")) {
+        nb::dict props = structure["props"];
+        add_properties_to_block(block, props);
+    }
+    if (structure.contains("atoms")) {
+        auto atom_block = std::make_shared<schrodinger::mae::IndexedBlock>(schrodinger::mae::ATOM_BLOCK);
+        nb::dict atoms = structure["atoms"];
+
+        add_indexed_properties_to_block(atom_block, atoms);
+        block_map->addIndexedBlock("m_atom", atom_block);
+    }
+    if (structure.contains("bonds")) {
+        auto bond_block = std::make_shared<schrodinger::mae::IndexedBlock>(schrodinger::mae::BOND_BLOCK);
+        nb::dict bonds = structure["bonds"];
+
+        add_indexed_properties_to_block(bond_block, bonds);
+        block_map->addIndexedBlock("m_bond", bond_block);
+    }
+
+    block->setIndexedBlockMap(block_map);
+    return block;
+}
+
+/**
+ * @brief Returns the CT block of a structure dictionary (see create_block) or of a Structure (see Structure::block)
+ */
+std::shared_ptr<schrodinger::mae::Block> structure_to_block(const nb::handle &structure) {
+    if (nb::isinstance<Structure>(structure)) { return nb::cast<Structure &>(structure).block(); }
+    return create_block(nb::cast<nb::dict>(structure));
+}
+
+/**
+ * @brief Writes structure information to an MAE file
+ * @param structures List of dictionaries containing structure information (see create_block) or Structures
+ * @param filename Path to the MAE file to write
+ * @param n_threads The number of threads to format structures on. Structures are converted to MAE blocks
+ *        while holding the GIL, and if more than one thread is requested, formatted on a pool of worker
+ *        threads while the next structures are being converted. The output is identical in both cases.
+ * @param float_precision If not set, structures are formatted using maeparser, which writes real values
+ *        with six decimal places. Otherwise, pairs of glob patterns and the number of decimal places to
+ *        write matching real properties with, where real properties matching no pattern are written using
+ *        their shortest round-trip representation.
+ * @param validate Whether to check each structure with validate_block. The structures are then written to a
+ *        temporary file which is only renamed to filename if every structure is valid, so an existing file is
+ *        left untouched otherwise. Once a structure fails, no further structures are written but all are still
+ *        checked.
+ * @throws ValidationException If validate is set and any structure fails validation
+ */
+void write_mae(const std::vector<nb::object> &structures,
+               const std::string &filename,
+               const size_t n_threads,
+               std::optional<std::vector<std::pair<std::string, int> > > float_precision,
+               const bool validate) {
+    std::vector<StructureIssue> issues;
+
+    const auto to_block = [&](const size_t i) -> std::shared_ptr<schrodinger::mae::Block> {
+        auto block = structure_to_block(structures[i]);
+
+        if (validate) { validate_structure(*block, i, std::nullopt, issues); }
+
+        return issues.empty() ? block : nullptr;
+    };
+
+    const auto output_filename = validate ? temporary_filename(filename) : filename;
+
+    const auto remove_output = [&] {
+        std::error_code error;
+        std::filesystem::remove(output_filename, error);
+    };
+
+    try {
+        const auto stream = open_output_stream(output_filename);
+        schrodinger::mae::Writer writer(stream);
+
+        std::shared_ptr<const BlockFormatter> formatter;
+
+        if (float_precision) {
+            formatter = std::make_shared<const BlockFormatter>(std::move(*float_precision));
+        }
+
+        if (n_threads <= 1) {
+            for (size_t i = 0; i < structures.size(); ++i) {
+                const auto block = to_block(i);
+
+                if (!block) { continue; }
+
+                if (formatter) {
+                    const auto buffer = format_block(*block, formatter.get());
+                    stream->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                } else {
+                    writer.write(block);
+                }
+            }
+        } else {
+            ParallelBlockWriter parallel_writer(stream, n_threads, formatter);
+
+            for (size_t i = 0; i < structures.size(); ++i) {
+                auto block = to_block(i);
+
+                if (!block) { continue; }
+
+                nb::gil_scoped_release release;
+                parallel_writer.write(std::move(block));
+            }
+
+            nb::gil_scoped_release release;
+            parallel_writer.close();
+        }
+    } catch (...) {
+        if (validate) { remove_output(); }
+        throw;
+    }
+
+    if (!issues.empty()) {
+        remove_output();
+        throw ValidationException(std::move(issues));
+    }
+    if (validate) {
+        std::error_code error;
+        std::filesystem::rename(output_filename, filename, error);
+
+        if (error) {
+            remove_output();
+            throw std::runtime_error("Could not write file: " + filename);
+        }
+    }
+}
+
+/**
+ * @brief A native worker thread which wakes a waiting asyncio event loop through a callback
+ * @details Consumers poll the worker without blocking, and mark themselves as waiting when they cannot make
+ *          progress. The worker then calls the notify callback (typically loop.call_soon_threadsafe(event.set))
+ *          the next time there is progress to make, so that the event loop never blocks on the worker.
+ */
+class AsyncWorker {
+public:
+    AsyncWorker(const AsyncWorker &) = delete;
+    AsyncWorker &operator=(const AsyncWorker &) = delete;
+
+    /**
+     * @brief Stops the worker thread as soon as possible and waits for it to exit
+     */
+    void close() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopped = true;
+        }
+        m_condition.notify_all();
+
+        nb::gil_scoped_release release;
+        std::lock_guard lock(m_join_mutex);
+
+        if (m_thread.joinable()) { m_thread.join(); }
+    }
+
+protected:
+    explicit AsyncWorker(std::function<void()> notify) : m_notify(std::move(notify)) {
+    }
+
+    ~AsyncWorker() { close(); }
+
+    /**
+     * @brief Runs a function on the worker thread, storing any exception it throws
+     */
+    void start(std::function<void()> body) {
+        m_thread = std::thread([this, body = std::move(body)] {
+            try {
+                body();
+            } catch (...) {
+                std::lock_guard lock(m_mutex);
+                m_error = std::current_exception();
+            }
+            {
+                std::lock_guard lock(m_mutex);
+                m_finished = true;
+            }
+            wake();
+        });
+    }
+
+    /**
+     * @brief Calls the notify callback if the consumer is waiting. Must be called without holding the mutex.
+     */
+    void wake() {
+        {
+            std::lock_guard lock(m_mutex);
+            if (!std::exchange(m_waiting, false)) { return; }
+        }
+
+        nb::gil_scoped_acquire acquire;
+
+        try {
+            m_notify();
+        } catch (const nb::python_error &) {
+            // the event loop may have been closed while the consumer was waiting
+        }
+    }
+
+    /**
+     * @brief Rethrows the exception thrown by the worker thread, if any. Must be called holding the mutex.
+     */
+    void check_error() {
+        if (m_error) { std::rethrow_exception(std::exchange(m_error, nullptr)); }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+
+    bool m_waiting = false; ///< Whether the consumer is waiting to be notified
+    bool m_stopped = false; ///< Whether the worker has been asked to stop
+    bool m_finished = false; ///< Whether the worker thread has finished
+
+private:
+    std::function<void()> m_notify;
+    std::exception_ptr m_error;
+
+    std::mutex m_join_mutex; ///< Serializes joining the worker thread, as close may be called from several threads
+    std::thread m_thread;
+};
+
+/**
+ * @brief Parses the structures of an MAE file on a native thread, for reading from an asyncio event loop
+ */
+class AsyncReader : public AsyncWorker {
+public:
+    /**
+     * @param filename Path to the MAE file to read
+     * @param notify Called from the worker thread when structures become available to a waiting consumer
+     * @param lazy Whether to return Structure objects rather than dictionaries
+     * @param capacity The maximum number of parsed structures to buffer
+     */
+    AsyncReader(const std::string &filename, std::function<void()> notify, const bool lazy, const size_t capacity)
+        : AsyncWorker(std::move(notify)), m_options{lazy}, m_capacity(std::max<size_t>(capacity, 1)) {
+        start([this, filename] {
+            schrodinger::mae::Reader reader(filename);
+
+            while (auto block = reader.next(schrodinger::mae::CT_BLOCK)) {
+                {
+                    std::unique_lock lock(m_mutex);
+                    m_condition.wait(lock, [this] { return m_stopped || m_blocks.size() < m_capacity; });
+
+                    if (m_stopped) { return; }
+                    m_blocks.push_back(std::move(block));
+                }
+                wake();
+            }
+        });
+    }
+
+    ~AsyncReader() { close(); }
+
+    /**
+     * @brief Converts up to max_structures of the structures parsed so far, without blocking
+     * @return The structures (see convert_structure), which are empty if none have been parsed since the last
+     *         call, or std::nullopt once every structure has been returned
+     * @throws std::exception Any exception thrown while parsing, once the structures before it are returned
+     */
+    std::optional<std::vector<nb::object> > take(const size_t max_structures) {
+        std::vector<std::shared_ptr<schrodinger::mae::Block> > blocks;
+        {
+            std::lock_guard lock(m_mutex);
+
+            while (!m_blocks.empty() && blocks.size() < std::max<size_t>(max_structures, 1)) {
+                blocks.push_back(std::move(m_blocks.front()));
+                m_blocks.pop_front();
+            }
+            if (blocks.empty()) {
+                check_error();
+
+                if (m_finished) { return std::nullopt; }
+                m_waiting = true;
+            }
+        }
+        m_condition.notify_all();
+
+        std::vector<nb::object> structures;
+        structures.reserve(blocks.size());
+
+        for (auto &block: blocks) { structures.push_back(convert_structure(std::move(block), m_options, m_schema)); }
+
+        return structures;
+    }
+
+private:
+    ConvertOptions m_options;
+    size_t m_capacity;
+
+    std::deque<std::shared_ptr<schrodinger::mae::Block> > m_blocks;
+    StructureSchema m_schema; ///< The schema of the last structure converted by take
+};
+
+/**
+ * @brief Writes structures to an MAE file on a native thread, for writing from an asyncio event loop
+ */
+class AsyncWriter : public AsyncWorker {
+public:
+    /**
+     * @param filename Path to the MAE file to write
+     * @param notify Called from the worker thread when a waiting consumer can make progress
+     * @param capacity The maximum number of structures to buffer
+     */
+    AsyncWriter(const std::string &filename, std::function<void()> notify, const size_t capacity)
+        : AsyncWorker(std::move(notify)), m_capacity(std::max<size_t>(capacity, 1)) {
+        start([this, filename] {
+            const auto stream = open_output_stream(filename);
+            schrodinger::mae::Writer writer(stream);
+
+            while (true) {
+                std::shared_ptr<schrodinger::mae::Block> block;
+                {
+                    std::unique_lock lock(m_mutex);
+                    m_condition.wait(lock, [this] { return m_stopped || m_closed || !m_blocks.empty(); });
+
+                    if (m_stopped || m_blocks.empty()) { break; }
+
+                    block = std::move(m_blocks.front());
+                    m_blocks.pop_front();
+                }
+                wake();
+                writer.write(block);
+            }
+        });
+    }
+
+    ~AsyncWriter() { close(); }
+
+    /**
+     * @brief Queues a structure to be written, without blocking
+     * @param structure A structure dictionary (see create_block) or Structure
+     * @return Whether the structure was queued, or false if the queue is full
+     */
+    bool put(const nb::handle &structure) {
+        {
+            std::lock_guard lock(m_mutex);
+            check_error();
+
+            if (m_finished) { throw std::runtime_error("The writer has stopped"); }
+
+            if (m_blocks.size() >= m_capacity) {
+                m_waiting = true;
+                return false;
+            }
+        }
+
+        auto block = structure_to_block(structure);
+        {
+            std::lock_guard lock(m_mutex);
+            m_blocks.push_back(std::move(block));
+        }
+        m_condition.notify_all();
+
+        return true;
+    }
+
+    /**
+     * @brief Marks the end of the structures to write, without blocking
+     * @return Whether every structure has been written and the file closed
+     */
+    bool finish() {
+        std::lock_guard lock(m_mutex);
+
+        m_closed = true;
+        m_condition.notify_all();
+
+        if (m_finished) {
+            check_error();
+            return true;
+        }
+        m_waiting = true;
+        return false;
+    }
+
+private:
+    size_t m_capacity;
+    bool m_closed = false; ///< Whether every structure has been queued
+
+    std::deque<std::shared_ptr<schrodinger::mae::Block> > m_blocks;
+};
+
+/**
+ * @brief A set of byte string keys which spills to sorted run files on disk once it holds too many in memory
+ * @details Each spill writes the in-memory keys to a new sorted run, and runs of similar size are merged so
+ *          that at most a logarithmic number of runs need to be binary searched when checking membership. Each
+ *          run file stores the offset of every key followed by the keys themselves.
+ */
+class SpillingKeySet {
+public:
+    /**
+     * @param max_memory_keys The maximum number of keys to hold in memory, or zero for no limit
+     * @param spill_directory The directory to write run files to, which must exist
+     */
+    SpillingKeySet(const size_t max_memory_keys, std::string spill_directory)
+        : m_max_memory_keys(max_memory_keys), m_spill_directory(std::move(spill_directory)) {
+    }
+
+    ~SpillingKeySet() {
+        for (auto &run: m_runs) { remove_run(run); }
+    }
+
+    SpillingKeySet(const SpillingKeySet &) = delete;
+    SpillingKeySet &operator=(const SpillingKeySet &) = delete;
+
+    /**
+     * @brief Inserts a key into the set
+     * @return True if the key was not already in the set
+     */
+    bool insert(std::string key) {
+        if (m_memory.count(key) > 0) { return false; }
+
+        for (const auto &run: m_runs) {
+            if (run.contains(key)) { return false; }
+        }
+
+        m_memory.insert(std::move(key));
+
+        if (m_max_memory_keys > 0 && m_memory.size() >= m_max_memory_keys) { spill(); }
+
+        return true;
+    }
+
+private:
+    struct Run {
+        std::string filename;
+        boost::iostreams::mapped_file_source file;
+        size_t size;
+
+        std::string_view key(const size_t i) const {
+            const auto *offsets = reinterpret_cast<const uint64_t *>(file.data());
+            const auto *keys = file.data() + (size + 1) * sizeof(uint64_t);
+
+            return {keys + offsets[i], offsets[i + 1] - offsets[i]};
+        }
+
+        bool contains(const std::string_view key) const {
+            size_t lo = 0, hi = size;
+
+            while (lo < hi) {
+                const auto mid = lo + (hi - lo) / 2;
+                const auto other = this->key(mid);
+
+                if (other == key) { return true; }
+                if (other < key) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            return false;
+        }
+    };
+
+    Run write_run(const std::vector<std::string_view> &keys) {
+        Run run{m_spill_directory + "/run-" + std::to_string(m_n_runs_written++) + ".bin", {}, keys.size()};
+
+        std::vector<uint64_t> offsets{0};
+        for (const auto &key: keys) { offsets.push_back(offsets.back() + key.size()); }
+
+        std::ofstream file(run.filename, std::ios_base::out | std::ios_base::binary);
+        file.write(reinterpret_cast<const char *>(offsets.data()),
+                   static_cast<std::streamsize>(offsets.size() * sizeof(uint64_t)));
+
+        for (const auto &key: keys) { file.write(key.data(), static_cast<std::streamsize>(key.size())); }
+
+        file.close();
+
+        if (!file) {
+            throw std::runtime_error("Could not write keys to: " + run.filename);
+        }
+
+        run.file.open(run.filename);
+        return run;
+    }
+
+    static void remove_run(Run &run) {
+        run.file.close();
+
+        std::error_code error;
+        std::filesystem::remove(run.filename, error);
+    }
+
+    void spill() {
+        std::vector<std::string_view> keys(m_memory.begin(), m_memory.end());
+        std::sort(keys.begin(), keys.end());
+
+        m_runs.push_back(write_run(keys));
+        m_memory.clear();
+
+        while (m_runs.size() > 1 && m_runs[m_runs.size() - 2].size <= 2 * m_runs.back().size) {
+            auto &a = m_runs[m_runs.size() - 2], &b = m_runs.back();
+
+            std::vector<std::string_view> merged;
+            merged.reserve(a.size + b.size);
+
+            for (size_t i = 0, j = 0; i < a.size || j < b.size;) {
+                if (j == b.size || (i < a.size && a.key(i) < b.key(j))) {
+                    merged.push_back(a.key(i++));
+                } else {
+                    merged.push_back(b.key(j++));
+                }
+            }
+
+            auto run = write_run(merged);
+
+            remove_run(a);
+            remove_run(b);
+            m_runs.pop_back();
+            m_runs.back() = std::move(run);
+        }
+    }
+
+    const size_t m_max_memory_keys;
+    const std::string m_spill_directory;
+
+    std::unordered_set<std::string> m_memory;
+    std::vector<Run> m_runs;
+    size_t m_n_runs_written = 0;
+};
+
+/**
+ * @brief Returns the value of a CT property of any type as a byte string, such that two values are equal only if
+ *        their types and values are equal (with -0.0 and 0.0 equal, as in hash_value)
+ * @param block The CT block
+ * @param name The name of the property
+ * @return The key, or std::nullopt if the block does not define the property
+ */
+std::optional<std::string> property_key(const schrodinger::mae::Block &block, const std::string &name) {
+    std::optional<std::string> key;
+
+    const auto key_if_present = [&](const auto &props) {
+        using T = typename std::decay_t<decltype(props)>::mapped_type;
+        const auto value = props.find(name);
+
+        if (value == props.end()) { return false; }
+
+        key.emplace(1, static_cast<char>(column_type<T>()));
+
+        if constexpr (std::is_same_v<T, std::string>) {
+            *key += value->second;
+        } else {
+            const T normalized = value->second == T() ? T() : value->second;
+            key->append(reinterpret_cast<const char *>(&normalized), sizeof(T));
+        }
+        return true;
+    };
+
+    if (key_if_present(block.getProperties<uint8_t>()) || key_if_present(block.getProperties<int>()) ||
+        key_if_present(block.getProperties<double>()) || key_if_present(block.getProperties<std::string>())) {
+        return key;
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Copies the structures of an MAE file to a new file, skipping any duplicates of earlier structures
+ * @details Structures are streamed from the input using schrodinger::mae::Reader and the first occurrence of
+ *          each is written using schrodinger::mae::Writer, so memory use is bounded by the set of seen keys.
+ * @param src_filename Path to the MAE file to read
+ * @param dst_filename Path to the MAE file to write
+ * @param key Either "content" to compare structures by a 128-bit hash of their content (see hash_block_state),
+ *        or the name of a CT property to compare the values of (see property_key). Structures which do not
+ *        define the property are always kept.
+ * @param coordinates Whether to include the atom coordinates when comparing by content
+ * @param display Whether to include display-only properties when comparing by content
+ * @param max_memory_keys The maximum number of keys to hold in memory before spilling them to disk, or zero
+ *        to keep every key in memory
+ * @param spill_directory An existing directory to spill keys to
+ * @return The number of structures written
+ */
+size_t dedup_mae(const std::string &src_filename,
+                 const std::string &dst_filename,
+                 const std::string &key,
+                 const bool coordinates,
+                 const bool display,
+                 const size_t max_memory_keys,
+                 const std::string &spill_directory) {
+    nb::gil_scoped_release release;
+
+    const HashOptions options{coordinates, display};
+
+    schrodinger::mae::Reader reader(src_filename);
+    schrodinger::mae::Writer writer(open_output_stream(dst_filename));
+
+    SpillingKeySet seen(max_memory_keys, spill_directory);
+    size_t n_written = 0;
+
+    while (const auto block = reader.next(schrodinger::mae::CT_BLOCK)) {
+        auto value = key == "content" ? hash_block_state(*block, options).digest128() : property_key(*block, key);
+
+        if (value && !seen.insert(std::move(*value))) { continue; }
+
+        writer.write(block);
+        ++n_written;
+    }
+
+    return n_written;
+}
+
+/**
+ * @brief Writes raw CT blocks verbatim to an MAE file, after the version header written by maeparser
+ */
+class RawBlockWriter {
+public:
+    /**
+     * @param filename Path to the MAE file to write, which will be GZipped if it ends with .gz or .maegz
+     */
+    explicit RawBlockWriter(const std::string &filename) : m_stream(open_output_stream(filename)) {
+        schrodinger::mae::Writer writer(m_stream);
+    }
+
+    /**
+     * @brief Appends the text of a block, followed by the blank line Block::write separates blocks with
+     */
+    void write(const std::string_view text) {
+        m_stream->write(text.data(), static_cast<std::streamsize>(text.size()));
+        m_stream->write("\n\n", 2);
+
+        if (!*m_stream) {
+            throw std::runtime_error("Failed to write to the MAE file");
+        }
+    }
+
+private:
+    std::shared_ptr<std::ostream> m_stream;
+};
+
+/**
+ * @brief Counts the structures in an MAE file by scanning for block boundaries, without parsing them, or
+ *        using its index if it has an up to date one (see index_mae)
+ * @param filename Path to the MAE file to read
+ * @return The number of structures
+ */
+size_t count_structures(const std::string &filename) {
+    nb::gil_scoped_release release;
+
+    if (const auto index = StructureIndex::open(filename, fingerprint_file(filename))) {
+        return index->size();
+    }
+
+    BlockScanner scanner(filename);
+    size_t n_structures = 0;
+
+    while (next_ct_block(scanner)) { ++n_structures; }
+
+    return n_structures;
+}
+
+/**
+ * @brief Splits an MAE file into files of consecutive structures, copying the bytes of each structure verbatim
+ * @param src_filename Path to the MAE file to split
+ * @param chunk_size The maximum number of structures to write to each file
+ * @param output_filename Returns the path of the i-th file to write
+ * @return The paths of the files written
+ */
+std::vector<std::string> split_mae(const std::string &src_filename,
+                                   const size_t chunk_size,
+                                   const std::function<std::string(size_t)> &output_filename) {
+    if (chunk_size == 0) {
+        throw std::invalid_argument("The chunk size must be greater than zero");
+    }
+
+    nb::gil_scoped_release release;
+
+    BlockScanner scanner(src_filename);
+    std::vector<std::string> filenames;
+    std::optional<RawBlockWriter> writer;
+
+    for (size_t i = 0; const auto block = next_ct_block(scanner); ++i) {
+        if (i % chunk_size == 0) {
+            {
+                nb::gil_scoped_acquire acquire;
+                filenames.push_back(output_filename(filenames.size()));
+            }
+            writer.reset();
+            writer.emplace(filenames.back());
+        }
+        writer->write(block->text);
+    }
+
+    return filenames;
+}
+
+/**
+ * @brief Concatenates the structures of several MAE files, copying the bytes of each structure verbatim
+ * @param src_filenames Paths to the MAE files to concatenate
+ * @param dst_filename Path to the MAE file to write
+ * @return The number of structures written
+ */
+size_t concat_mae(const std::vector<std::string> &src_filenames, const std::string &dst_filename) {
+    nb::gil_scoped_release release;
+
+    RawBlockWriter writer(dst_filename);
+    size_t n_written = 0;
+
+    for (const auto &src_filename: src_filenames) {
+        BlockScanner scanner(src_filename);
+
+        while (const auto block = next_ct_block(scanner)) {
+            writer.write(block->text);
+            ++n_written;
+        }
+    }
+
+    return n_written;
+}
+
+/**
+ * @brief Copies a slice of the structures of an MAE file, copying the bytes of each structure verbatim
+ * @param src_filename Path to the MAE file to read
+ * @param dst_filename Path to the MAE file to write
+ * @param start The index of the first structure to copy
+ * @param stop The index to stop copying structures at (exclusive), or std::nullopt to copy to the end
+ * @param step The step between the indices of copied structures
+ * @return The number of structures written
+ */
+size_t slice_mae(const std::string &src_filename,
+                 const std::string &dst_filename,
+                 const size_t start,
+                 const std::optional<size_t> stop,
+                 const size_t step) {
+    if (step == 0) {
+        throw std::invalid_argument("The slice step must be greater than zero");
+    }
+
+    nb::gil_scoped_release release;
+
+    BlockScanner scanner(src_filename);
+    RawBlockWriter writer(dst_filename);
+    size_t n_written = 0;
+
+    for (size_t i = 0; i < stop.value_or(std::numeric_limits<size_t>::max()); ++i) {
+        const auto block = next_ct_block(scanner);
+
+        if (!block) { break; }
+        if (i < start || (i - start) % step != 0) { continue; }
+
+        writer.write(block->text);
+        ++n_written;
+    }
+
+    return n_written;
+}
+
+/**
+ * @brief The CT properties to set on a structure when patching an MAE file (see patch_mae)
+ * @details Each property is stored as its name and the raw MAE token of its value, or std::nullopt if the
+ *          property should be removed.
+ */
+using CtPatch = std::vector<std::pair<std::string, std::optional<std::string> > >;
+
+/**
+ * @brief Converts a dictionary of CT properties to a patch, formatting each value as an MAE token
+ * @param props The properties to set, where None removes a property
+ * @throws std::runtime_error If a property has an unsupported type
+ */
+CtPatch create_ct_patch(const nb::dict &props) {
+    CtPatch patch;
+
+    for (const auto &item: props) {
+        auto key = nb::cast<std::string>(item.first);
+        const nb::handle value = item.second;
+
+        if (value.is_none()) {
+            patch.emplace_back(std::move(key), std::nullopt);
+            continue;
+        }
+
+        std::string token;
+
+        if (key.compare(0, 2, "i_") == 0) {
+            token = std::to_string(nb::cast<int>(value));
+        } else if (key.compare(0, 2, "r_") == 0) {
+            char buffer[64];
+            const auto result = std::to_chars(buffer, buffer + sizeof(buffer), nb::cast<double>(value));
+
+            if (result.ec != std::errc()) {
+                throw std::runtime_error("Could not format value as text");
+            }
+            token.assign(buffer, result.ptr);
+        } else if (key.compare(0, 2, "s_") == 0) {
+            append_mae_string(token, nb::cast<std::string>(value));
+        } else if (key.compare(0, 2, "b_") == 0) {
+            token = nb::cast<bool>(value) ? "1" : "0";
+        } else {
+            throw std::runtime_error("Unsupported property type for key: " + key);
+        }
+
+        patch.emplace_back(std::move(key), std::move(token));
+    }
+    return patch;
+}
+
+/**
+ * @brief Rewrites the CT properties of the text of a raw f_m_ct block, copying the rest of the text verbatim
+ * @param text The text of the block
+ * @param header The parsed CT properties of the block (see parse_ct_header)
+ * @param patches The patches to apply, in order
+ * @return The text of the patched block
+ */
+std::string apply_ct_patches(const std::string_view text,
+                             const CtHeader &header,
+                             const std::vector<const CtPatch *> &patches) {
+    std::vector<std::string> names(header.names.begin(), header.names.end());
+    std::vector<std::optional<std::string> > values(header.values.begin(), header.values.end());
+
+    for (const auto *patch: patches) {
+        for (const auto &[name, value]: *patch) {
+            const auto existing = std::find(names.begin(), names.end(), name);
+
+            if (existing != names.end()) {
+                values[existing - names.begin()] = value;
+            } else if (value) {
+                names.push_back(name);
+                values.push_back(value);
+            }
+        }
+    }
+
+    std::string patched(text.substr(0, header.begin));
+    patched += '\n';
+
+    if (std::any_of(values.begin(), values.end(), [](const auto &value) { return value.has_value(); })) {
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (!values[i]) { continue; }
+
+            patched += "  ";
+            patched += names[i];
+            patched += '\n';
+        }
+        patched += "  :::\n";
+
+        for (const auto &value: values) {
+            if (!value) { continue; }
+
+            patched += "  ";
+            patched += *value;
+            patched += '\n';
+        }
+    }
+
+    // the rest of the block is copied from the start of the line containing its first token
+    const auto rest = text.substr(header.end);
+    const auto line = rest.rfind('\n', rest.find_first_not_of(" \t\r\n"));
+
+    patched += rest.substr(line == std::string_view::npos ? 0 : line + 1);
+
+    return patched;
+}
+
+/**
+ * @brief Copies the structures of an MAE file, setting or removing CT properties of selected structures
+ * @details Only the CT properties of patched structures are rewritten (see apply_ct_patches). Their atom and bond
+ *          blocks, and every other structure, are copied verbatim without being parsed, so patching takes time
+ *          proportional to the size of the file rather than the number of atoms.
+ * @param src_filename Path to the MAE file to read
+ * @param dst_filename Path to the MAE file to write
+ * @param updates The CT properties to set (see create_ct_patch) keyed by either the index of a structure, or
+ *        a title, which patches every structure with that title. Index patches are applied after title patches.
+ * @return The number of structures patched
+ */
+size_t patch_mae(const std::string &src_filename, const std::string &dst_filename, const nb::dict &updates) {
+    std::unordered_map<size_t, CtPatch> index_patches;
+    std::unordered_map<std::string, CtPatch> title_patches;
+
+    for (const auto &item: updates) {
+        auto patch = create_ct_patch(nb::cast<nb::dict>(item.second));
+
+        if (nb::isinstance<nb::str>(item.first)) {
+            title_patches[nb::cast<std::string>(item.first)] = std::move(patch);
+        } else {
+            index_patches[nb::cast<size_t>(item.first)] = std::move(patch);
+        }
+    }
+
+    nb::gil_scoped_release release;
+
+    BlockScanner scanner(src_filename);
+    RawBlockWriter writer(dst_filename);
+    size_t n_patched = 0;
+
+    for (size_t i = 0; const auto block = next_ct_block(scanner); ++i) {
+        const auto header = parse_ct_header(block->text);
+        std::vector<const CtPatch *> patches;
+
+        if (!title_patches.empty()) {
+            if (const auto title = header.find(schrodinger::mae::CT_TITLE)) {
+                const auto patch = title_patches.find(unquote_mae_string(*title));
+                if (patch != title_patches.end()) { patches.push_back(&patch->second); }
+            }
+        }
+        if (const auto patch = index_patches.find(i); patch != index_patches.end()) {
+            patches.push_back(&patch->second);
+        }
+
+        if (patches.empty()) {
+            writer.write(block->text);
+            continue;
+        }
+
+        writer.write(apply_ct_patches(block->text, header, patches));
+        ++n_patched;
+    }
+
+    return n_patched;
+}
+
+/**
+ * @brief Converts the CT properties of a raw f_m_ct block to a Python dictionary
+ * @param header The parsed CT properties (see parse_ct_header)
+ * @return The properties, including the title, with None for undefined values
+ * @throws std::runtime_error If a numeric value cannot be parsed
+ */
+nb::dict convert_ct_header(const CtHeader &header) {
+    nb::dict props;
+
+    for (size_t i = 0; i < header.names.size(); ++i) {
+        const auto name = header.names[i];
+        const auto token = header.values[i];
+
+        const auto key = nb::str(name.data(), name.size());
+
+        if (name.compare(0, 2, "s_") == 0) {
+            props[key] = token == "<>" ? nb::none() : nb::cast(unquote_mae_string(token));
+            continue;
+        }
+
+        const auto value = parse_mae_number(token);
+
+        if (!value) {
+            props[key] = nb::none();
+        } else if (name.compare(0, 2, "b_") == 0) {
+            props[key] = *value != 0;
+        } else if (name.compare(0, 2, "i_") == 0) {
+            props[key] = static_cast<int>(*value);
+        } else {
+            props[key] = *value;
+        }
+    }
+    return props;
+}
+
+/**
+ * @brief Iterates over the CT blocks of an MAE file as their CT properties and raw bytes, without parsing their
+ *        atoms or bonds
+ * @details The bytes of each block are the buffer the scanner copied the block into, which is handed to Python as
+ *          a read-only memoryview rather than copied again, so blocks can be forwarded (e.g. with
+ *          MaeWriter::write_raw) without being re-formatted.
+ */
+class RawBlockReader {
+public:
+    explicit RawBlockReader(const std::string &filename) : m_scanner(filename) {
+    }
+
+    /**
+     * @brief Returns the CT properties (see convert_ct_header) and bytes of the next CT block, or std::nullopt at
+     *        the end of the file
+     */
+    std::optional<std::pair<nb::dict, nb::object> > next() {
+        std::unique_ptr<std::string> text;
+        CtHeader header;
+        {
+            nb::gil_scoped_release release;
+
+            auto block = next_ct_block(m_scanner);
+            if (!block) { return std::nullopt; }
+
+            text = std::make_unique<std::string>(std::move(block->text));
+            header = parse_ct_header(*text);
+        }
+
+        // the capsule owns the text, which the views of the header point into
+        auto props = convert_ct_header(header);
+
+        const auto *data = text->data();
+        const auto size = text->size();
+
+        nb::capsule owner(text.release(), [](void *p) noexcept { delete static_cast<std::string *>(p); });
+        auto bytes = nb::ndarray<nb::memview, const uint8_t, nb::ndim<1> >(data, {size}, owner);
+
+        return std::make_pair(std::move(props), nb::cast(bytes));
+    }
+
+private:
+    BlockScanner m_scanner;
+};
+
+/**
+ * @brief Writes structures to an MAE file one at a time, either from Python objects or as raw CT blocks
+ */
+class MaeWriter {
+public:
+    /**
+     * @param filename Path to the MAE file to write, which will be GZipped if it ends with .gz or .maegz
+     */
+    explicit MaeWriter(const std::string &filename) : m_writer(std::in_place, filename) {
+    }
+
+    /**
+     * @brief Writes a structure dictionary (see create_block) or Structure, formatted using Block::write
+     */
+    void write(const nb::handle &structure) {
+        const auto text = format_block(*structure_to_block(structure), nullptr);
+        writer().write(std::string_view(text).substr(0, text.find_last_not_of(" \t\r\n") + 1));
+    }
+
+    /**
+     * @brief Writes the bytes of a CT block verbatim, e.g. as returned by RawBlockReader
+     * @param text The bytes of the block, from the start of its name to its closing brace
+     */
+    void write_raw(const NumpyColumn<uint8_t> &text) {
+        writer().write(std::string_view(static_cast<const char *>(text.data()), text.shape(0)));
+    }
+
+    /**
+     * @brief Flushes and closes the file. Any further writes raise an error.
+     */
+    void close() { m_writer.reset(); }
+
+private:
+    RawBlockWriter &writer() {
+        if (!m_writer) {
+            throw std::runtime_error("The MAE writer has been closed");
+        }
+        return *m_writer;
+    }
+
+    std::optional<RawBlockWriter> m_writer;
+};
+
+/**
+ * @brief A structure being sorted by sort_mae, identified by its index in the input file
+ */
+struct SortRecord {
+    bool missing; ///< Whether the structure does not define the sort key
+    double number; ///< The value of a numeric sort key
+    std::string string; ///< The value of a string sort key
+    uint64_t index;
+    std::string text; ///< The raw text of the structure
+};
+
+/**
+ * @brief Sets the key of a sort record from the raw value token of a CT property
+ * @details The record is left missing if the property is undefined or is a NaN number, which has no order
+ *          relative to other numbers.
+ */
+void set_sort_key(SortRecord &record, const std::optional<std::string_view> &value, const bool is_string_key) {
+    record.missing = true;
+
+    if (!value || *value == "<>") { return; }
+
+    if (is_string_key) {
+        record.string = unquote_mae_string(*value);
+    } else {
+        record.number = *parse_mae_number(*value);
+
+        if (std::isnan(record.number)) { return; }
+    }
+    record.missing = false;
+}
+
+/**
+ * @brief Orders sort records by key, placing records without the key last and breaking ties by index
+ */
+struct SortOrder {
+    bool descending;
+
+    bool operator()(const SortRecord &a, const SortRecord &b) const {
+        if (a.missing != b.missing) { return b.missing; }
+
+        if (!a.missing) {
+            const auto &[lhs, rhs] = descending ? std::tie(b, a) : std::tie(a, b);
+
+            if (lhs.number != rhs.number) { return lhs.number < rhs.number; }
+            if (lhs.string != rhs.string) { return lhs.string < rhs.string; }
+        }
+        return a.index < b.index;
+    }
+};
+
+/**
+ * @brief The maximum number of sorted runs merged at once by sort_mae, which bounds the number of open files
+ */
+constexpr size_t MAX_MERGE_RUNS = 64;
+
+/**
+ * @brief The path of a temporary file, which is removed when the path is destroyed
+ */
+class TemporaryPath {
+public:
+    explicit TemporaryPath(std::string path) : m_path(std::move(path)) {
+    }
+
+    ~TemporaryPath() { remove(); }
+
+    TemporaryPath(TemporaryPath &&other) noexcept : m_path(std::exchange(other.m_path, {})) {
+    }
+
+    TemporaryPath &operator=(TemporaryPath &&other) noexcept {
+        if (this != &other) {
+            remove();
+            m_path = std::exchange(other.m_path, {});
+        }
+        return *this;
+    }
+
+    const std::string &str() const { return m_path; }
+
+private:
+    void remove() {
+        if (m_path.empty()) { return; }
+
+        std::error_code error;
+        std::filesystem::remove(m_path, error);
+    }
+
+    std::string m_path;
+};
+
+/**
+ * @brief Writes a sorted run of records to a temporary file, one at a time
+ */
+class SortRunWriter {
+public:
+    explicit SortRunWriter(std::string filename)
+        : m_filename(std::move(filename)), m_file(m_filename, std::ios_base::out | std::ios_base::binary) {
+    }
+
+    void write(const SortRecord &record) {
+        const uint64_t sizes[2] = {record.string.size(), record.text.size()};
+
+        write(&record.missing, sizeof(record.missing));
+        write(&record.number, sizeof(record.number));
+        write(&record.index, sizeof(record.index));
+        write(sizes, sizeof(sizes));
+        write(record.string.data(), record.string.size());
+        write(record.text.data(), record.text.size());
+    }
+
+    /**
+     * @throws std::runtime_error If any of the records could not be written
+     */
+    void close() {
+        m_file.close();
+
+        if (!m_file) {
+            throw std::runtime_error("Could not write sorted structures to: " + m_filename);
+        }
+    }
+
+private:
+    void write(const void *data, const size_t size) {
+        m_file.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+    }
+
+    std::string m_filename;
+    std::ofstream m_file;
+};
+
+/**
+ * @brief Reads back the records of a sorted run written by SortRunWriter, one at a time
+ */
+class SortRunReader {
+public:
+    explicit SortRunReader(const std::string &filename)
+        : m_file(filename, std::ios_base::in | std::ios_base::binary) {
+    }
+
+    std::optional<SortRecord> next() {
+        SortRecord record{};
+        uint64_t sizes[2];
+
+        if (!read(&record.missing, sizeof(record.missing))) { return std::nullopt; }
+
+        if (!read(&record.number, sizeof(record.number)) || !read(&record.index, sizeof(record.index)) ||
+            !read(sizes, sizeof(sizes))) {
+            throw std::runtime_error("Could not read sorted structures");
+        }
+
+        record.string.resize(sizes[0]);
+        record.text.resize(sizes[1]);
+
+        if (!read(record.string.data(), sizes[0]) || !read(record.text.data(), sizes[1])) {
+            throw std::runtime_error("Could not read sorted structures");
+        }
+        return record;
+    }
+
+private:
+    bool read(void *data, const size_t size) {
+        m_file.read(static_cast<char *>(data), static_cast<std::streamsize>(size));
+        return static_cast<size_t>(m_file.gcount()) == size;
+    }
+
+    std::ifstream m_file;
+};
+
+/**
+ * @brief Merges sorted runs written by SortRunWriter, passing each record to a callback in sorted order
+ */
+template<typename Callback>
+void merge_sort_runs(const std::vector<TemporaryPath> &runs, const SortOrder &order, Callback &&callback) {
+    std::vector<SortRunReader> readers;
+    readers.reserve(runs.size());
+
+    std::vector<std::pair<SortRecord, size_t> > heads;
+
+    const auto compare_heads = [&order](const auto &a, const auto &b) { return order(b.first, a.first); };
+
+    for (size_t i = 0; i < runs.size(); ++i) {
+        readers.emplace_back(runs[i].str());
+
+        if (auto record = readers.back().next()) { heads.emplace_back(std::move(*record), i); }
+    }
+    std::make_heap(heads.begin(), heads.end(), compare_heads);
+
+    while (!heads.empty()) {
+        std::pop_heap(heads.begin(), heads.end(), compare_heads);
+        auto &[record, run] = heads.back();
+
+        callback(record);
+
+        if (auto next_record = readers[run].next()) {
+            record = std::move(*next_record);
+            std::push_heap(heads.begin(), heads.end(), compare_heads);
+        } else {
+            heads.pop_back();
+        }
+    }
+}
+
+/**
+ * @brief Sorts the structures of an MAE file by the value of a CT property, using an external merge sort
+ * @details Only the CT properties of each structure are parsed to extract its key. The raw text of structures
+ *          is gathered into runs until they exceed the memory limit, and each run is sorted and spilled to a
+ *          temporary file before the runs are merged, at most MAX_MERGE_RUNS at a time. Structures are copied
+ *          verbatim rather than re-formatted.
+ * @param src_filename Path to the MAE file to sort
+ * @param dst_filename Path to the MAE file to write
+ * @param key The name of the CT property to sort by. s_ properties are compared as strings, and any other
+ *        property as a number. Structures which do not define the property, or define it as NaN, are written
+ *        last.
+ * @param descending Whether to sort in descending order
+ * @param memory_limit The approximate number of bytes of structure text to hold in memory before spilling
+ * @param spill_directory An existing directory to spill sorted runs to
+ * @return The number of structures written
+ */
+size_t sort_mae(const std::string &src_filename,
+                const std::string &dst_filename,
+                const std::string &key,
+                const bool descending,
+                const size_t memory_limit,
+                const std::string &spill_directory) {
+    nb::gil_scoped_release release;
+
+    const SortOrder order{descending};
+    const auto is_string_key = key.compare(0, 2, "s_") == 0;
+
+    BlockScanner scanner(src_filename);
+
+    std::vector<SortRecord> records;
+    std::vector<TemporaryPath> runs;
+    size_t n_bytes = 0, n_structures = 0, n_runs_written = 0;
+
+    const auto new_run = [&] {
+        return TemporaryPath(spill_directory + "/run-" + std::to_string(n_runs_written++) + ".bin");
+    };
+    const auto spill = [&] {
+        std::sort(records.begin(), records.end(), order);
+
+        runs.push_back(new_run());
+        SortRunWriter run_writer(runs.back().str());
+
+        for (const auto &record: records) { run_writer.write(record); }
+        run_writer.close();
+
+        records.clear();
+        n_bytes = 0;
+    };
+
+    while (auto block = next_ct_block(scanner)) {
+        SortRecord record{true, 0.0, {}, n_structures++, {}};
+        set_sort_key(record, parse_ct_header(block->text).find(key), is_string_key);
+
+        n_bytes += block->text.size() + record.string.size() + sizeof(SortRecord);
+        record.text = std::move(block->text);
+        records.push_back(std::move(record));
+
+        if (n_bytes > memory_limit) { spill(); }
+    }
+
+    RawBlockWriter writer(dst_filename);
+
+    if (runs.empty()) {
+        std::sort(records.begin(), records.end(), order);
+
+        for (const auto &record: records) { writer.write(record.text); }
+        return n_structures;
+    }
+    if (!records.empty()) { spill(); }
+
+    // the oldest runs are merged first, so that each record is merged a logarithmic number of times
+    while (runs.size() > MAX_MERGE_RUNS) {
+        std::vector<TemporaryPath> merging(std::make_move_iterator(runs.begin()),
+                                           std::make_move_iterator(runs.begin() + MAX_MERGE_RUNS));
+        runs.erase(runs.begin(), runs.begin() + MAX_MERGE_RUNS);
+
+        auto merged = new_run();
+        SortRunWriter run_writer(merged.str());
+
+        merge_sort_runs(merging, order, [&run_writer](const SortRecord &record) { run_writer.write(record); });
+        run_writer.close();
+
+        runs.push_back(std::move(merged));
+    }
+
+    merge_sort_runs(runs, order, [&writer](const SortRecord &record) { writer.write(record.text); });
+    return n_structures;
+}
+
+/**
+ * @brief The location of a CT block in the decompressed text of an MAE file
+ */
+struct BlockRange {
+    uint64_t offset;
+    uint64_t size;
+};
+
+/**
+ * @brief Reads the text of CT blocks of an MAE file, seeking to each if the file is uncompressed and otherwise
+ *        scanning the file until the last block has been read
+ * @param filename Path to the MAE file
+ * @param ranges The blocks to read, found by an earlier scan of the file, in increasing order of offset
+ * @return The text of each block
+ */
+std::vector<std::string> read_block_ranges(const std::string &filename, const std::vector<BlockRange> &ranges) {
+    std::vector<std::string> texts;
+    texts.reserve(ranges.size());
+
+    if (!is_gzipped(filename)) {
+        std::ifstream file(filename, std::ios_base::in | std::ios_base::binary);
+
+        for (const auto &range: ranges) {
+            auto &text = texts.emplace_back(range.size, '\0');
+
+            file.seekg(static_cast<std::streamoff>(range.offset));
+            file.read(text.data(), static_cast<std::streamsize>(text.size()));
+
+            if (!file) {
+                throw std::runtime_error("Could not read file: " + filename);
+            }
+        }
+        return texts;
+    }
+
+    BlockScanner scanner(filename);
+
+    while (texts.size() < ranges.size()) {
+        auto block = next_ct_block(scanner);
+
+        if (!block) {
+            throw std::runtime_error("The MAE file was modified while it was being read: " + filename);
+        }
+        if (block->offset == ranges[texts.size()].offset) { texts.push_back(std::move(block->text)); }
+    }
+    return texts;
+}
+
+/**
+ * @brief Selects the k structures of an MAE file with the best values of a CT property
+ * @details Only the CT properties of each structure are parsed while streaming the file, and a bounded heap
+ *          holds the key and location of the best k structures seen so far. Only these are read again and
+ *          fully parsed at the end, so memory use does not depend on the size of the structures.
+ * @param filename Path to the MAE file
+ * @param key The name of the CT property to rank by. s_ properties are compared as strings, and any other
+ *        property as a number. Structures which do not define the property, or define it as NaN, are never
+ *        selected.
+ * @param k The maximum number of structures to select
+ * @param largest Whether to select the structures with the largest rather than smallest values
+ * @return The selected structures (see convert_block), best first with ties in file order
+ */
+std::vector<nb::dict> top_k_mae(const std::string &filename, const std::string &key, const size_t k,
+                                const bool largest) {
+    const SortOrder order{largest};
+    const auto is_string_key = key.compare(0, 2, "s_") == 0;
+
+    std::vector<std::pair<SortRecord, BlockRange> > heap;
+    std::vector<std::string> texts;
+
+    const auto compare = [&order](const auto &a, const auto &b) { return order(a.first, b.first); };
+
+    {
+        nb::gil_scoped_release release;
+
+        BlockScanner scanner(filename);
+        uint64_t index = 0;
+
+        while (auto block = next_ct_block(scanner)) {
+            if (k == 0) { break; }
+
+            SortRecord record{true, 0.0, {}, index++, {}};
+            set_sort_key(record, parse_ct_header(block->text).find(key), is_string_key);
+
+            if (record.missing) { continue; }
+
+            if (heap.size() == k) {
+                if (!order(record, heap.front().first)) { continue; }
+
+                std::pop_heap(heap.begin(), heap.end(), compare);
+                heap.pop_back();
+            }
+
+            heap.emplace_back(std::move(record), BlockRange{block->offset, block->text.size()});
+            std::push_heap(heap.begin(), heap.end(), compare);
+        }
+
+        std::sort_heap(heap.begin(), heap.end(), compare);
+
+        // read_block_ranges needs the blocks in file order, which is the order of their indices
+        std::vector<size_t> file_order(heap.size());
+        std::iota(file_order.begin(), file_order.end(), 0);
+        std::sort(file_order.begin(), file_order.end(), [&heap](const size_t a, const size_t b) {
+            return heap[a].first.index < heap[b].first.index;
+        });
+
+        std::vector<BlockRange> ranges;
+        ranges.reserve(heap.size());
+
+        for (const auto i: file_order) { ranges.push_back(heap[i].second); }
+
+        auto file_texts = read_block_ranges(filename, ranges);
+        texts.resize(heap.size());
+
+        for (size_t i = 0; i < file_order.size(); ++i) { texts[file_order[i]] = std::move(file_texts[i]); }
+    }
+
+    std::vector<nb::dict> structures;
+    structures.reserve(texts.size());
+
+    StructureSchema schema;
+
+    for (auto &text: texts) { structures.push_back(convert_block(*parse_raw_block(std::move(text)), schema)); }
+    return structures;
+}
+
+/**
+ * @brief Python module for reading and writing Maestro MAE files
+ * @param m The module object to define functions in
+ * @details Provides functionality to read and write MAE files and extract structure information
+ *          including atoms, bonds, and global properties
+ */
+NB_MODULE(pymaeparser_ext, m) {
+    nb::class_<Structure>(m, "Structure")
+            .def(nb::init<const nb::dict &>())
+            .def_prop_ro("title", &Structure::title, nb::lock_self())
+            .def_prop_ro("props", &Structure::props, nb::lock_self())
+            .def_prop_ro("atoms", &Structure::atoms, nb::lock_self())
+            .def_prop_ro("bonds", &Structure::bonds, nb::lock_self())
+            .def("__getitem__", &Structure::get, nb::lock_self())
+            .def("__setitem__", &Structure::set, nb::lock_self())
+            .def("__contains__", [](const Structure &, const nb::handle &key) {
+                return nb::isinstance<nb::str>(key) && Structure::contains(nb::cast<std::string>(key));
+            })
+            .def("__len__", [](const Structure &) { return std::size(Structure::KEYS); })
+            .def("__iter__", [](const Structure &) {
+                return nb::iter(nb::make_tuple("title", "props", "atoms", "bonds"));
+            })
+            .def("keys", [](const Structure &) { return nb::make_tuple("title", "props", "atoms", "bonds"); })
+            .def("items", [](Structure &self) { return self.to_dict().items(); }, nb::lock_self())
+            .def("values", [](Structure &self) { return self.to_dict().values(); }, nb::lock_self())
+            .def("get", [](Structure &self, const std::string &key, const nb::object &default_value) {
+                return Structure::contains(key) ? self.get(key) : default_value;
+            }, nb::arg("key"), nb::arg("default") = nb::none(), nb::lock_self())
+            .def("to_dict", &Structure::to_dict, nb::lock_self())
+            .def("__eq__", [](Structure &self, const nb::handle &other) {
+                if (nb::isinstance<Structure>(other)) {
+                    return self.to_dict().equal(nb::cast<Structure &>(other).to_dict());
+                }
+                return nb::isinstance<nb::dict>(other) && self.to_dict().equal(other);
+            }, nb::arg("other").lock(), nb::lock_self())
+            .def("__repr__", [](Structure &self) {
+                return "Structure(title=" + nb::cast<std::string>(nb::repr(self.title())) + ")";
+            }, nb::lock_self());
+
+    nb::enum_<BoolFormat>(m, "BoolFormat")
+            .value("list", BoolFormat::List)
+            .value("numpy", BoolFormat::Numpy)
+            .value("packed", BoolFormat::Packed);
+
+    nb::enum_<ColumnFormat>(m, "ColumnFormat")
+            .value("list", ColumnFormat::List)
+            .value("numpy", ColumnFormat::Numpy);
+
+    nb::class_<PackedBits>(m, "PackedBits")
+            .def(nb::init<nb::handle, size_t, nb::handle>(),
+                 nb::arg("bits"),
+                 nb::arg("size"),
+                 nb::arg("nulls") = nb::none())
+            .def_prop_ro("bits", &PackedBits::bits)
+            .def_prop_ro("nulls", &PackedBits::nulls)
+            .def_prop_ro("size", &PackedBits::size)
+            .def("__len__", &PackedBits::size)
+            .def("unpack", &PackedBits::unpack)
+            .def("__repr__", [](const PackedBits &self) {
+                return "PackedBits(size=" + std::to_string(self.size()) + ")";
+            });
+
+    nb::class_<StructureIssue>(m, "StructureIssue")
+            .def_ro("structure", &StructureIssue::structure)
+            .def_ro("offset", &StructureIssue::offset)
+            .def_ro("message", &StructureIssue::message)
+            .def("__repr__", [](const StructureIssue &self) {
+                return "StructureIssue(structure=" + std::to_string(self.structure) + ", offset=" +
+                       (self.offset ? std::to_string(*self.offset) : "None") + ", message=" +
+                       nb::cast<std::string>(nb::repr(nb::cast(self.message))) + ")";
+            });
+
+    const auto validation_error = PyErr_NewException("pymaeparser_ext.ValidationError", PyExc_ValueError, nullptr);
+    m.attr("ValidationError") = nb::borrow(validation_error);
+
+    nb::register_exception_translator([](const std::exception_ptr &p, void *payload) {
+        try {
+            std::rethrow_exception(p);
+        } catch (const ValidationException &e) {
+            const auto type = nb::handle(static_cast<PyObject *>(payload));
+
+            const auto error = type(e.what());
+            error.attr("errors") = nb::cast(e.issues());
+
+            PyErr_SetObject(type.ptr(), error.ptr());
+        }
+    }, validation_error);
+
+    nb::class_<AsyncReader>(m, "AsyncReader")
+            .def(nb::init<const std::string &, std::function<void()>, bool, size_t>())
+            .def("take", &AsyncReader::take, nb::lock_self())
+            .def("close", &AsyncReader::close);
+
+    nb::class_<AsyncWriter>(m, "AsyncWriter")
+            .def(nb::init<const std::string &, std::function<void()>, size_t>())
+            .def("put", &AsyncWriter::put)
+            .def("finish", &AsyncWriter::finish)
+            .def("close", &AsyncWriter::close);
+
+    nb::class_<SharedDataset>(m, "SharedDataset")
+            .def_static("create", &SharedDataset::create)
+            .def_static("attach", &SharedDataset::attach)
+            .def_prop_ro("name", &SharedDataset::name)
+            .def("unlink", &SharedDataset::unlink)
+            .def("__len__", &SharedDataset::size)
+            .def("__getitem__", [](const SharedDataset &self, int64_t i) {
+                return self.get(static_cast<size_t>(i < 0 ? i + static_cast<int64_t>(self.size()) : i));
+            })
+            .def("table", [](const nb::handle self, const std::string &name) {
+                return nb::cast<const SharedDataset &>(self).table(name, self);
+            })
+            .def("__getstate__", [](const SharedDataset &self) { return self.name(); })
+            .def("__setstate__", [](SharedDataset &self, const std::string &name) {
+                new(&self) SharedDataset(SharedDataset::attach(name));
+            });
+
+    nb::class_<RawBlockReader>(m, "RawBlockReader")
+            .def(nb::init<const std::string &>(), nb::arg("filename"))
+            .def("next", &RawBlockReader::next, nb::lock_self());
+
+    nb::class_<MaeWriter>(m, "MaeWriter")
+            .def(nb::init<const std::string &>(), nb::arg("filename"))
+            .def("write", &MaeWriter::write, nb::arg("structure"), nb::lock_self())
+            .def("write_raw", &MaeWriter::write_raw, nb::arg("text"), nb::lock_self())
+            .def("close", &MaeWriter::close, nb::lock_self());
+
+    nb::class_<MaeDataset>(m, "MaeDataset")
+            .def(nb::init<std::string, size_t, bool>(), nb::arg("filename"), nb::arg("cache_size") = 128,
+                 nb::arg("lazy") = false)
+            .def_prop_ro("filename", &MaeDataset::filename)
+            .def("__len__", &MaeDataset::size)
+            .def("__getitem__", [](MaeDataset &self, int64_t i) {
+                return self.get(static_cast<size_t>(i < 0 ? i + static_cast<int64_t>(self.size()) : i));
+            }, nb::lock_self())
+            .def("__getstate__", [](const MaeDataset &self) {
+                return std::make_tuple(self.filename(), self.cache_size(), self.lazy());
+            })
+            .def("__setstate__", [](MaeDataset &self, const std::tuple<std::string, size_t, bool> &state) {
+                new(&self) MaeDataset(std::get<0>(state), std::get<1>(state), std::get<2>(state));
+            });
+
+    nb::class_<ReadOptions>(m, "ReadOptions")
+            .def(nb::init<>())
+            .def_rw("cache", &ReadOptions::cache)
+            .def_rw("return_hashes", &ReadOptions::return_hashes)
+            .def_rw("hash_coordinates", &ReadOptions::hash_coordinates)
+            .def_rw("hash_display", &ReadOptions::hash_display)
+            .def_rw("start", &ReadOptions::start)
+            .def_rw("stop", &ReadOptions::stop)
+            .def_rw("step", &ReadOptions::step)
+            .def_rw("lazy", &ReadOptions::lazy)
+            .def_rw("pipelined", &ReadOptions::pipelined)
+            .def_rw("chunk_queue_depth", &ReadOptions::chunk_queue_depth)
+            .def_rw("block_queue_depth", &ReadOptions::block_queue_depth)
+            .def_rw("validate", &ReadOptions::validate)
+            .def_rw("skip_errors", &ReadOptions::skip_errors)
+            .def_rw("n_threads", &ReadOptions::n_threads)
+            .def_rw("bool_format", &ReadOptions::bool_format)
+            .def_rw("column_format", &ReadOptions::column_format);
+
+    m.def("read_mae", [](const std::string &filename, const ReadOptions &options) {
+        auto result = read_mae(filename, options);
+        return std::make_tuple(std::move(result.structures), std::move(result.hashes), std::move(result.errors));
+    }, "Read an MAE file and return atoms/bonds info");
+    m.def("read_mae_ragged", &read_mae_ragged, "Read an MAE file into contiguous columns spanning every structure");
+    m.def("bond_graph", &bond_graph, "Compute the bond graph of a structure");
+    m.def("read_mae_graphs", &read_mae_graphs, "Read the bond graphs of the structures in an MAE file");
+    m.def("hash_structures", &hash_structures, "Compute a content hash of each structure in an MAE file");
+    m.def("validate_mae", &validate_mae, "Check the structures in an MAE file for problems");
+    m.def("dedup_mae", &dedup_mae, "Copy an MAE file, skipping duplicate structures");
+    m.def("count_structures", &count_structures, "Count the structures in an MAE file without parsing them");
+    m.def("index_mae", &index_mae, "Create an index of the offsets of the structures in an MAE file");
+    m.def("split_mae", &split_mae, "Split an MAE file into files of consecutive structures");
+    m.def("concat_mae", &concat_mae, "Concatenate the structures of several MAE files");
+    m.def("slice_mae", &slice_mae, "Copy a slice of the structures of an MAE file");
+    m.def("patch_mae", &patch_mae, "Copy an MAE file, setting CT properties of selected structures");
+    m.def("sort_mae", &sort_mae, "Sort the structures of an MAE file by a CT property");
+    m.def("top_k_mae", &top_k_mae, "Select the structures of an MAE file with the best CT property values");
     m.def("write_mae", &write_mae, "Write an MAE file containing atoms/bonds info");
 }
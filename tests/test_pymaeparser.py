@@ -1,5 +1,12 @@
+import asyncio
+import concurrent.futures
+import copy
+import pickle
 import pathlib
+import sys
+import sysconfig
 
+import numpy
 import pytest
 
 import pymaeparser
@@ -10,6 +17,45 @@ def data_dir() -> pathlib.Path:
     return pathlib.Path(__file__).parent / "data"
 
 
+@pytest.fixture
+def benzoate(data_dir) -> dict:
+    return pymaeparser.read_mae(data_dir / "benzoate.mae")[0]
+
+
+@pytest.fixture
+def benzoate_file(benzoate, tmp_path):
+    """Returns a function which writes `n` copies of benzoate, titled `benzoate-{i}`
+    by default, to `tmp_path / name` and returns the path and the structures."""
+
+    def write(n: int, name: str = "in.mae", title=lambda i: f"benzoate-{i}"):
+        structures = [{**benzoate, "title": title(i)} for i in range(n)]
+
+        path = tmp_path / name
+        pymaeparser.write_mae(structures, path)
+
+        return path, structures
+
+    return write
+
+
+@pytest.fixture
+def scored_structures(benzoate) -> list[dict]:
+    """Copies of benzoate with an r_m_prop_a score, which is undefined for two of
+    them and NaN for one."""
+    scores = [3.5, None, -1.0, 3.5, 10.0, None, 0.25, float("nan")]
+    structures = []
+
+    for i, score in enumerate(scores):
+        props = dict(benzoate["props"])
+        if score is None:
+            props.pop("r_m_prop_a")
+        else:
+            props["r_m_prop_a"] = score
+        structures.append({**benzoate, "props": props, "title": f"benzoate-{i}"})
+
+    return structures
+
+
 def test_pymaeparser(data_dir, tmp_path):
     parsed = pymaeparser.read_mae(data_dir / "benzoate.mae")
 
@@ -19,3 +65,713 @@ def test_pymaeparser(data_dir, tmp_path):
     assert parsed == reparsed
     assert isinstance(reparsed[0]["atoms"]["b_m_prop_a"][0], bool)
     assert isinstance(reparsed[0]["props"]["b_m_prop_d"], bool)
+
+
+def test_write_mae_parallel(benzoate_file, tmp_path):
+    path, structures = benzoate_file(64, "serial.mae")
+
+    pymaeparser.write_mae(structures, tmp_path / "parallel.mae", n_threads=4)
+
+    expected = path.read_bytes()
+    assert (tmp_path / "parallel.mae").read_bytes() == expected
+
+
+def test_write_mae_float_format(data_dir, tmp_path):
+    parsed = pymaeparser.read_mae(data_dir / "benzoate.mae")
+
+    pymaeparser.write_mae(parsed, tmp_path / "shortest.mae", float_format="shortest")
+    pymaeparser.write_mae(parsed, tmp_path / "coords.mae", float_format={"r_m_*_coord": 3})
+
+    assert pymaeparser.read_mae(tmp_path / "shortest.mae") == parsed
+    assert pymaeparser.read_mae(tmp_path / "coords.mae") == parsed
+
+    assert " 0.750 -1.299 0.000 " in (tmp_path / "coords.mae").read_text()
+    assert (tmp_path / "shortest.mae").stat().st_size < (data_dir / "benzoate.mae").stat().st_size
+
+    # indexed blocks other than the atoms and bonds are kept
+    text = (data_dir / "benzoate.mae").read_text()
+    depend = (
+        "  m_depend[1] {\n"
+        "    # First column is Index #\n"
+        "    i_m_depend_dependency\n"
+        "    s_m_depend_property\n"
+        "    :::\n"
+        "    1 10 s_m_title\n"
+        "    :::\n"
+        "  }\n"
+    )
+    end = text.rindex("}")
+    (tmp_path / "depend.mae").write_text(text[:end] + depend + text[end:])
+
+    structures = pymaeparser.read_mae(tmp_path / "depend.mae", lazy=True)
+    pymaeparser.write_mae(structures, tmp_path / "out.mae", float_format="shortest")
+
+    assert depend in (tmp_path / "out.mae").read_text()
+    assert pymaeparser.read_mae(tmp_path / "out.mae") == parsed
+
+
+def test_read_mae_cache(data_dir, tmp_path):
+    path = tmp_path / "benzoate.mae"
+    path.write_bytes((data_dir / "benzoate.mae").read_bytes())
+
+    expected = pymaeparser.read_mae(path)
+
+    assert pymaeparser.read_mae(path, cache=True) == expected
+    assert (tmp_path / "benzoate.mae.maebin").exists()
+    assert pymaeparser.read_mae(path, cache=True) == expected
+
+    # a corrupt structure count is detected rather than read out of bounds
+    cache = bytearray((tmp_path / "benzoate.mae.maebin").read_bytes())
+    cache[40:48] = (2**64 - 1).to_bytes(8, "little")
+    (tmp_path / "benzoate.mae.maebin").write_bytes(bytes(cache))
+
+    assert pymaeparser.read_mae(path, cache=True) == expected
+    assert not list(tmp_path.glob("*.tmp*"))
+
+    pymaeparser.write_mae([{**expected[0], "title": "modified"}], path)
+    assert pymaeparser.read_mae(path, cache=True)[0]["title"] == "modified"
+
+
+def test_hash_structures(data_dir, tmp_path):
+    structure = pymaeparser.read_mae(data_dir / "benzoate.mae")[0]
+
+    moved = copy.deepcopy(structure)
+    moved["atoms"]["r_m_x_coord"] = [x + 1.0 for x in moved["atoms"]["r_m_x_coord"]]
+    recolored = copy.deepcopy(structure)
+    recolored["atoms"]["s_m_color_rgb"] = ["FFFFFF"] * len(structure["atoms"]["i_m_atomic_number"])
+
+    pymaeparser.write_mae([structure, moved, recolored, structure], tmp_path / "out.mae")
+
+    hashes = pymaeparser.hash_structures(tmp_path / "out.mae")
+    assert hashes[0] == hashes[3]
+    assert len({*hashes[:3]}) == 3
+
+    assert len({*pymaeparser.hash_structures(tmp_path / "out.mae", coordinates=False, display=False)}) == 1
+
+    structures, read_hashes = pymaeparser.read_mae(tmp_path / "out.mae", return_hashes=True)
+    assert read_hashes == hashes
+    assert len(structures) == 4
+
+    _, cached_hashes = pymaeparser.read_mae(tmp_path / "out.mae", cache=True, return_hashes=True)
+    _, cached_hashes = pymaeparser.read_mae(tmp_path / "out.mae", cache=True, return_hashes=True)
+    assert cached_hashes == hashes
+
+
+@pytest.mark.parametrize("max_memory_hashes", [None, 1])
+def test_dedup_mae(benzoate_file, tmp_path, max_memory_hashes):
+    _, structures = benzoate_file(10, title=lambda i: f"benzoate-{i % 3}")
+
+    n_written = pymaeparser.dedup_mae(
+        tmp_path / "in.mae", tmp_path / "out.mae", max_memory_hashes=max_memory_hashes
+    )
+    assert n_written == 3
+    assert pymaeparser.read_mae(tmp_path / "out.mae") == structures[:3]
+
+    n_written = pymaeparser.dedup_mae(
+        tmp_path / "in.mae", tmp_path / "out.mae", key="i_m_prop_b"
+    )
+    assert n_written == 1
+
+    n_written = pymaeparser.dedup_mae(
+        tmp_path / "in.mae",
+        tmp_path / "out.mae",
+        key="s_m_title",
+        max_memory_hashes=max_memory_hashes,
+    )
+    assert n_written == 3
+    assert pymaeparser.read_mae(tmp_path / "out.mae") == structures[:3]
+
+
+def test_split_concat_slice_mae(benzoate_file, tmp_path):
+    gzipped, _ = benzoate_file(10, "in.maegz")
+    path, structures = benzoate_file(10)
+
+    paths = pymaeparser.split_mae(gzipped, str(tmp_path / "{}.mae"), 4)
+    assert paths == [tmp_path / "0.mae", tmp_path / "1.mae", tmp_path / "2.mae"]
+    assert [len(pymaeparser.read_mae(path)) for path in paths] == [4, 4, 2]
+
+    assert pymaeparser.concat_mae(paths, tmp_path / "concat.mae") == 10
+    assert (tmp_path / "concat.mae").read_bytes() == path.read_bytes()
+
+    assert pymaeparser.slice_mae(path, tmp_path / "slice.mae", 1, -2, 3) == 3
+    assert pymaeparser.read_mae(tmp_path / "slice.mae") == structures[1:-2:3]
+
+    titles = ["{", "benzoate{", "}"]
+    braced_path, braced = benzoate_file(3, "braced.mae", title=lambda i: titles[i])
+
+    paths = pymaeparser.split_mae(braced_path, str(tmp_path / "braced-{}.mae"), 1)
+    assert [pymaeparser.read_mae(path) for path in paths] == [[s] for s in braced]
+
+
+@pytest.mark.parametrize("memory_limit", [2**30, 1])
+def test_sort_mae(scored_structures, tmp_path, memory_limit):
+    structures = scored_structures
+    pymaeparser.write_mae(structures, tmp_path / "in.maegz")
+
+    n_written = pymaeparser.sort_mae(
+        tmp_path / "in.maegz",
+        tmp_path / "sorted.mae",
+        "r_m_prop_a",
+        descending=True,
+        memory_limit=memory_limit,
+    )
+    assert n_written == len(structures)
+
+    sorted_structures = pymaeparser.read_mae(tmp_path / "sorted.mae")
+    assert [s["title"] for s in sorted_structures] == [
+        "benzoate-4",
+        "benzoate-0",
+        "benzoate-3",
+        "benzoate-6",
+        "benzoate-2",
+        "benzoate-1",
+        "benzoate-5",
+        "benzoate-7",
+    ]
+
+    pymaeparser.sort_mae(tmp_path / "in.maegz", tmp_path / "titles.mae", "s_m_title")
+    titles = [s["title"] for s in pymaeparser.read_mae(tmp_path / "titles.mae")]
+    assert titles == sorted(s["title"] for s in structures)
+
+
+def test_sort_mae_many_runs(benzoate_file, tmp_path):
+    benzoate_file(150, title=lambda i: f"benzoate-{i * 7 % 150:03d}")
+
+    # one run is spilled per structure, which needs more than one merge pass
+    pymaeparser.sort_mae(
+        tmp_path / "in.mae", tmp_path / "sorted.mae", "s_m_title", memory_limit=1
+    )
+    titles = [s["title"] for s in pymaeparser.read_mae(tmp_path / "sorted.mae")]
+    assert titles == [f"benzoate-{i:03d}" for i in range(150)]
+
+
+@pytest.mark.parametrize("suffix", [".mae", ".maegz"])
+def test_top_k_mae(scored_structures, tmp_path, suffix):
+    structures = scored_structures
+    path = tmp_path / f"in{suffix}"
+
+    pymaeparser.write_mae(structures, path)
+
+    smallest = pymaeparser.top_k_mae(path, "r_m_prop_a", 3)
+    assert smallest == [structures[2], structures[6], structures[0]]
+
+    largest = pymaeparser.top_k_mae(path, "r_m_prop_a", 2, largest=True)
+    assert largest == [structures[4], structures[0]]
+
+    everything = pymaeparser.top_k_mae(path, "r_m_prop_a", 100)
+    assert [s["title"] for s in everything] == [
+        "benzoate-2",
+        "benzoate-6",
+        "benzoate-0",
+        "benzoate-3",
+        "benzoate-4",
+    ]
+
+
+@pytest.mark.parametrize("suffix", [".mae", ".maegz"])
+def test_read_mae_slice(benzoate_file, tmp_path, suffix):
+    path, structures = benzoate_file(10, f"in{suffix}")
+
+    assert pymaeparser.read_mae(path, start=2, stop=7, step=2) == structures[2:7:2]
+    assert pymaeparser.read_mae(path, start=-3) == structures[-3:]
+
+    assert pymaeparser.index_mae(path) == 10
+    assert (tmp_path / f"in{suffix}.maeidx").exists()
+
+    assert pymaeparser.read_mae(path, start=1, step=3) == structures[1::3]
+    assert pymaeparser.read_mae(path, stop=-8) == structures[:-8]
+
+    sliced, hashes = pymaeparser.read_mae(path, return_hashes=True, step=5)
+    assert sliced == structures[::5]
+    assert hashes == pymaeparser.hash_structures(path)[::5]
+
+    cached = pymaeparser.read_mae(path, cache=True, start=4, stop=6)
+    assert cached == pymaeparser.read_mae(path, cache=True, start=4, stop=6)
+    assert [s["title"] for s in cached] == ["benzoate-4", "benzoate-5"]
+
+
+def test_read_mae_full_streams(benzoate_file, tmp_path):
+    path, structures = benzoate_file(3)
+    assert pymaeparser.index_mae(path) == 3
+
+    # drop the first structure from the index, so that reads which use it skip it
+    index_path = tmp_path / "in.mae.maeidx"
+    index = bytearray(index_path.read_bytes())
+
+    index[40:48] = (2).to_bytes(8, "little")
+    index_path.write_bytes(bytes(index[:56] + index[64:]))
+
+    assert pymaeparser.read_mae(path, stop=2) == structures[1:]
+    # reading every structure should stream them rather than reading a slice
+    assert pymaeparser.read_mae(path) == structures
+
+
+def test_read_mae_lazy(data_dir, tmp_path):
+    expected = pymaeparser.read_mae(data_dir / "benzoate.mae")
+    structures = pymaeparser.read_mae(data_dir / "benzoate.mae", lazy=True)
+
+    assert len(structures) == 1
+    structure = structures[0]
+
+    assert structure.title == "benzoate"
+    assert structure["props"] is structure["props"]
+    assert structure == expected[0]
+    assert dict(structure) == expected[0]
+    assert {**structure} == structure.to_dict()
+
+    pymaeparser.write_mae(
+        pymaeparser.read_mae(data_dir / "benzoate.mae", lazy=True),
+        tmp_path / "unmodified.mae",
+    )
+    assert pymaeparser.read_mae(tmp_path / "unmodified.mae") == expected
+
+    structure["props"]["r_m_prop_a"] = 2.0
+    structure["title"] = "modified"
+    pymaeparser.write_mae([structure], tmp_path / "modified.mae")
+
+    modified = pymaeparser.read_mae(tmp_path / "modified.mae")[0]
+    assert modified["title"] == "modified"
+    assert modified["props"]["r_m_prop_a"] == 2.0
+    assert modified["atoms"] == expected[0]["atoms"]
+
+
+def test_read_mae_ragged(data_dir, tmp_path):
+    structure = pymaeparser.read_mae(data_dir / "benzoate.mae")[0]
+
+    no_bonds = {"title": "no-bonds", "props": structure["props"]}
+    no_bonds["atoms"] = {k: v[:2] for k, v in structure["atoms"].items()}
+    no_bonds["atoms"]["r_m_charge1"] = [None, 0.5]
+
+    pymaeparser.write_mae([structure, no_bonds, structure], tmp_path / "in.mae")
+
+    ragged = pymaeparser.read_mae_ragged(tmp_path / "in.mae")
+
+    atoms = ragged["atoms"]
+    assert atoms["offsets"].tolist() == [0, 14, 16, 30]
+    assert atoms["present"].tolist() == [True, True, True]
+
+    assert atoms["columns"]["i_m_atomic_number"].dtype == numpy.int32
+    assert atoms["columns"]["r_m_x_coord"].dtype == numpy.float64
+    assert atoms["columns"]["b_m_prop_a"].dtype == numpy.bool_
+
+    assert atoms["columns"]["r_m_x_coord"][16:30].tolist() == (
+        structure["atoms"]["r_m_x_coord"]
+    )
+    assert atoms["columns"]["s_m_pdb_atom_name"][14:16] == [" C  ", " C  "]
+
+    charges = atoms["nulls"]["r_m_charge1"]
+    assert numpy.flatnonzero(charges).tolist() == [14]
+
+    bonds = ragged["bonds"]
+    assert bonds["offsets"].tolist() == [0, 14, 14, 28]
+    assert bonds["present"].tolist() == [True, False, True]
+
+    props = ragged["props"]
+    assert props["columns"]["s_m_title"] == ["benzoate", "no-bonds", "benzoate"]
+    assert props["columns"]["r_m_prop_a"].tolist() == [1.0, 1.0, 1.0]
+
+
+def test_bond_graph(data_dir, tmp_path):
+    structure = pymaeparser.read_mae(data_dir / "benzoate.mae")[0]
+    bonds = structure["bonds"]
+
+    graph = pymaeparser.bond_graph(structure, undirected=False)
+
+    expected_edges = [
+        [i - 1 for i in bonds["i_m_from"]],
+        [i - 1 for i in bonds["i_m_to"]],
+    ]
+    assert graph["edge_index"].shape == (2, 14)
+    assert graph["edge_index"].tolist() == expected_edges
+    assert graph["order"].tolist() == bonds["i_m_order"]
+
+    indptr, indices = graph["indptr"], graph["indices"]
+    assert len(indptr) == 15
+    assert sorted(indices[indptr[6] : indptr[7]].tolist()) == [3, 7, 8]
+
+    undirected = pymaeparser.bond_graph(structure)
+    assert undirected["edge_index"].shape == (2, 28)
+    assert undirected["edge_index"][:, 1].tolist() == [1, 0]
+
+    columnar = pymaeparser.read_mae(data_dir / "benzoate.mae", column_format="numpy")[0]
+    assert isinstance(columnar["bonds"]["i_m_from"], tuple)
+
+    dense = {**columnar, "bonds": {k: v[0] for k, v in columnar["bonds"].items()}}
+
+    for other in (columnar, dense):
+        graph = pymaeparser.bond_graph(other)
+        assert graph["edge_index"].tolist() == undirected["edge_index"].tolist()
+        assert graph["order"].tolist() == undirected["order"].tolist()
+
+    pymaeparser.write_mae([structure, structure], tmp_path / "in.mae")
+    batch = pymaeparser.read_mae_graphs(tmp_path / "in.mae")
+
+    assert batch["atom_offsets"].tolist() == [0, 14, 28]
+    assert batch["edge_offsets"].tolist() == [0, 28, 56]
+    assert (batch["edge_index"][:, 28:] - 14).tolist() == (
+        undirected["edge_index"].tolist()
+    )
+    assert batch["indptr"][-1] == 56
+
+
+def test_async_read_write_mae(benzoate_file, tmp_path):
+    path, structures = benzoate_file(100)
+
+    async def round_trip():
+        await pymaeparser.async_write_mae(structures, tmp_path / "out.maegz", 8)
+
+        read = await pymaeparser.async_read_mae(tmp_path / "out.maegz")
+        assert read == await pymaeparser.async_read_mae(path)
+
+        copied = pymaeparser.async_iter_mae(tmp_path / "out.maegz", batch_size=3)
+        await pymaeparser.async_write_mae(copied, tmp_path / "copy.mae")
+
+        return read
+
+    assert asyncio.run(round_trip()) == structures
+    assert pymaeparser.read_mae(tmp_path / "copy.mae") == structures
+
+
+@pytest.mark.parametrize("suffix", [".mae", ".maegz"])
+def test_read_mae_pipelined(benzoate_file, tmp_path, suffix):
+    path, structures = benzoate_file(500, f"in{suffix}")
+
+    read = pymaeparser.read_mae(
+        path,
+        pipelined=True,
+        chunk_queue_depth=1,
+        block_queue_depth=2,
+    )
+    assert read == structures
+
+    with pytest.raises(RuntimeError):
+        pymaeparser.read_mae(tmp_path / "missing.mae", pipelined=True)
+
+
+def test_shared_dataset(benzoate_file):
+    path, structures = benzoate_file(3)
+
+    dataset = pymaeparser.create_shared_dataset(path)
+
+    try:
+        attached = pymaeparser.attach_shared_dataset(dataset.name)
+
+        assert len(attached) == 3
+        assert [attached[i] for i in range(3)] == structures
+        assert attached[-1] == structures[-1]
+
+        atoms = attached.table("atoms")
+        assert atoms["offsets"].tolist() == [0, 14, 28, 42]
+
+        x = atoms["columns"]["r_m_x_coord"]
+        assert not x.flags.writeable
+        assert x[14:28].tolist() == structures[1]["atoms"]["r_m_x_coord"]
+
+        unpickled = pickle.loads(pickle.dumps(attached))
+        assert unpickled.name == dataset.name
+        assert unpickled[1] == structures[1]
+    finally:
+        dataset.unlink()
+
+    with pytest.raises(RuntimeError):
+        pymaeparser.attach_shared_dataset(dataset.name)
+
+
+@pytest.mark.parametrize("suffix", [".mae", ".maegz"])
+def test_mae_dataset(benzoate_file, tmp_path, suffix):
+    # enough structures to span several gzip checkpoints
+    path, structures = benzoate_file(1000, f"in{suffix}")
+
+    dataset = pymaeparser.MaeDataset(path, cache_size=4)
+
+    assert len(dataset) == 1000
+    assert (tmp_path / f"in{suffix}.maeidx").exists()
+
+    for i in [999, 0, 500, 501, 500, -1, 123]:
+        assert dataset[i] == structures[i]
+
+    assert dataset[10:13] == structures[10:13]
+
+    with pytest.raises(IndexError):
+        dataset[1000]
+
+    unpickled = pickle.loads(pickle.dumps(dataset))
+    assert unpickled[777] == structures[777]
+
+    lazy = pymaeparser.MaeDataset(path, lazy=True)
+    assert lazy[42].title == "benzoate-42"
+
+    # an index whose structure count overflows its expected size is rebuilt
+    index_path = tmp_path / f"in{suffix}.maeidx"
+    index = bytearray(index_path.read_bytes())
+
+    n_structures = int.from_bytes(index[40:48], "little")
+    index[40:48] = (n_structures + 2**61).to_bytes(8, "little")
+    index_path.write_bytes(bytes(index))
+
+    assert len(pymaeparser.MaeDataset(path)) == 1000
+
+
+def test_validate_mae(data_dir, tmp_path):
+    structure = pymaeparser.read_mae(data_dir / "benzoate.mae")[0]
+    assert pymaeparser.validate_mae(data_dir / "benzoate.mae") == []
+
+    invalid = copy.deepcopy(structure)
+    invalid["bonds"]["i_m_to"][3] = 15
+    del invalid["atoms"]["r_m_z_coord"]
+
+    structures = [structure, invalid, structure]
+    path = tmp_path / "invalid.mae"
+
+    with pytest.raises(ValueError) as error:
+        pymaeparser.write_mae(structures, path, validate=True)
+
+    assert [e.structure for e in error.value.errors] == [1, 1]
+    assert not path.exists()
+
+    pymaeparser.write_mae(structures, path)
+
+    issues = pymaeparser.validate_mae(path)
+    assert [(e.structure, e.message) for e in issues] == [
+        (1, "m_atom is missing required column r_m_z_coord"),
+        (1, "m_bond 4 has i_m_to 15, outside 1..14"),
+    ]
+    assert path.read_text()[issues[0].offset :].startswith("f_m_ct")
+
+    with pytest.raises(ValueError) as error:
+        pymaeparser.read_mae(path, validate=True)
+
+    assert [e.offset for e in error.value.errors] == [e.offset for e in issues]
+    assert pymaeparser.read_mae(path, start=2, validate=True) == [structure]
+
+    # an existing file is left untouched, and no temporary files are left behind
+    files = sorted(tmp_path.iterdir())
+    text = path.read_text()
+
+    with pytest.raises(ValueError):
+        pymaeparser.write_mae(structures, path, validate=True)
+
+    assert path.read_text() == text
+    assert sorted(tmp_path.iterdir()) == files
+
+
+def test_read_mae_skip_errors(benzoate_file, tmp_path):
+    valid, structures = benzoate_file(4, "valid.mae")
+    text = valid.read_text()
+
+    # truncate the second structure part way through its atoms
+    blocks = text.split("f_m_ct {")
+    blocks[2] = blocks[2][: blocks[2].index("m_bond") // 2] + "\n"
+
+    path = tmp_path / "corrupt.mae"
+    path.write_text("f_m_ct {".join(blocks))
+
+    with pytest.raises(RuntimeError):
+        pymaeparser.read_mae(path)
+
+    read, errors = pymaeparser.read_mae(path, on_error="skip")
+
+    assert read == [structures[0], structures[2], structures[3]]
+    assert [e.structure for e in errors] == [1]
+    assert path.read_text()[errors[0].offset :].startswith("f_m_ct")
+    assert errors[0].message
+
+    read, hashes, errors = pymaeparser.read_mae(
+        path, on_error="skip", return_hashes=True, start=2
+    )
+    assert read == structures[2:]
+    assert len(hashes) == 2
+    assert errors == []
+
+    # truncate the second structure part way through its quoted title
+    valid, structures = benzoate_file(3, "valid.mae", title=lambda i: f"benzoate {i}")
+    text = valid.read_text()
+
+    blocks = text.split("f_m_ct {")
+    blocks[2] = blocks[2][: blocks[2].index('"benzoate 1"') + 5] + "\n"
+
+    path.write_text("f_m_ct {".join(blocks))
+
+    read, errors = pymaeparser.read_mae(path, on_error="skip")
+
+    assert read == [structures[0], structures[2]]
+    assert [e.structure for e in errors] == [1]
+
+
+@pytest.mark.free_threaded
+def test_read_mae_threads(benzoate_file, monkeypatch):
+    path, structures = benzoate_file(100)
+
+    # convert on several threads even if the GIL is enabled, which is slower but equivalent
+    monkeypatch.setattr(pymaeparser, "_is_gil_enabled", lambda: False)
+
+    assert pymaeparser.read_mae(path, n_threads=4) == structures
+    assert pymaeparser.read_mae(path, n_threads=4, step=3) == structures[::3]
+
+
+@pytest.mark.free_threaded
+def test_free_threaded_access(benzoate_file):
+    path, structures = benzoate_file(100)
+
+    lazy = pymaeparser.read_mae(path, lazy=True)
+    dataset = pymaeparser.MaeDataset(path, cache_size=4, lazy=True)
+
+    # the lazy structures and the dataset cache are shared by every thread
+    def access(offset: int) -> bool:
+        for i in range(len(structures)):
+            j = (offset + i) % len(structures)
+
+            assert lazy[j] == structures[j]
+            assert dataset[j] == structures[j]
+
+        return True
+
+    with concurrent.futures.ThreadPoolExecutor(8) as executor:
+        assert all(executor.map(access, range(0, 100, 13)))
+
+
+@pytest.mark.free_threaded
+@pytest.mark.skipif(
+    not sysconfig.get_config_var("Py_GIL_DISABLED"),
+    reason="requires a free-threaded build of Python",
+)
+def test_free_threaded_gil_disabled():
+    # importing the extension should not re-enable the GIL
+    assert not sys._is_gil_enabled()
+
+
+def test_read_mae_schema_reuse(data_dir, tmp_path):
+    structure = pymaeparser.read_mae(data_dir / "benzoate.mae")[0]
+
+    changed = copy.deepcopy(structure)
+    changed["atoms"]["r_m_new"] = [1.0] * 14
+    del changed["atoms"]["i_m_formal_charge"]
+    changed["props"]["i_m_new"] = 1
+
+    structures = [structure, structure, changed, structure]
+    pymaeparser.write_mae(structures, tmp_path / "in.mae")
+
+    read = pymaeparser.read_mae(tmp_path / "in.mae")
+    assert read == structures
+
+    # the keys of consecutive structures with the same columns are shared
+    first, second = ([*s["atoms"]] for s in read[:2])
+    assert all(a is b for a, b in zip(first, second))
+
+
+@pytest.mark.parametrize("bool_format", ["numpy", "packed"])
+def test_read_mae_bool_format(data_dir, tmp_path, bool_format):
+    expected = pymaeparser.read_mae(data_dir / "benzoate.mae")[0]
+
+    expected["atoms"]["b_m_prop_a"][3] = None
+    pymaeparser.write_mae([expected], tmp_path / "in.mae")
+
+    structure = pymaeparser.read_mae(tmp_path / "in.mae", bool_format=bool_format)[0]
+    column = structure["atoms"]["b_m_prop_a"]
+
+    if bool_format == "packed":
+        assert len(column) == 14
+        column = column.unpack()
+
+    values, nulls = column
+    assert values.dtype == numpy.bool_
+    assert numpy.flatnonzero(nulls).tolist() == [3]
+    assert [
+        None if null else bool(value) for value, null in zip(values, nulls)
+    ] == expected["atoms"]["b_m_prop_a"]
+
+    pymaeparser.write_mae([structure], tmp_path / "out.mae")
+    assert pymaeparser.read_mae(tmp_path / "out.mae") == [expected]
+
+
+def test_pack_bits():
+    values = numpy.arange(20) % 3 == 0
+    packed = pymaeparser.pack_bits(values, nulls=values & False)
+
+    assert packed.size == 20
+    assert packed.bits.tolist() == numpy.packbits(values, bitorder="little").tolist()
+
+    unpacked, nulls = packed.unpack()
+    assert unpacked.tolist() == values.tolist()
+    assert not nulls.any()
+
+    # non-contiguous arrays are copied once, and the copies kept alive by the column
+    from pymaeparser.pymaeparser_ext import PackedBits
+
+    strided = numpy.repeat(packed.bits, 2)[::2]
+    converted = PackedBits(strided, 20)
+    del strided
+
+    assert converted.bits.tolist() == packed.bits.tolist()
+    assert converted.unpack()[0].tolist() == values.tolist()
+
+
+def test_read_mae_column_format(data_dir, tmp_path):
+    expected = pymaeparser.read_mae(data_dir / "benzoate.mae")[0]
+
+    expected["atoms"]["r_m_x_coord"][2] = None
+    expected["atoms"]["s_m_pdb_atom_name"][5] = None
+    pymaeparser.write_mae([expected], tmp_path / "in.mae")
+
+    structure = pymaeparser.read_mae(tmp_path / "in.mae", column_format="numpy")[0]
+    atoms = structure["atoms"]
+
+    values, nulls = atoms["r_m_x_coord"]
+    assert values.dtype == numpy.float64
+    assert numpy.flatnonzero(nulls).tolist() == [2]
+
+    values, nulls = atoms["i_m_atomic_number"]
+    assert values.dtype == numpy.int32
+    assert values.tolist() == expected["atoms"]["i_m_atomic_number"]
+    assert nulls is None
+
+    values, nulls = atoms["s_m_pdb_atom_name"]
+    assert numpy.flatnonzero(nulls).tolist() == [5]
+    assert values[:5] == expected["atoms"]["s_m_pdb_atom_name"][:5]
+
+    assert atoms["b_m_prop_a"][0].dtype == numpy.bool_
+
+    pymaeparser.write_mae([structure], tmp_path / "out.mae")
+    assert pymaeparser.read_mae(tmp_path / "out.mae") == [expected]
+
+
+def test_patch_mae(benzoate_file, tmp_path):
+    path, structures = benzoate_file(4)
+
+    updates = {
+        "benzoate-1": {"r_m_score": 1.5, "b_m_prop_d": None},
+        3: {"s_m_title": "patched", "i_m_prop_b": 7},
+    }
+    assert pymaeparser.patch_mae(path, tmp_path / "out.mae", updates) == 2
+
+    patched = pymaeparser.read_mae(tmp_path / "out.mae")
+    assert [s["atoms"] for s in patched] == [s["atoms"] for s in structures]
+    assert patched[0] == structures[0]
+
+    expected_props = {**structures[1]["props"], "r_m_score": 1.5}
+    del expected_props["b_m_prop_d"]
+    assert patched[1]["props"] == expected_props
+
+    assert patched[3]["title"] == "patched"
+    assert patched[3]["props"]["i_m_prop_b"] == 7
+
+
+def test_iter_mae_raw(benzoate_file, tmp_path):
+    path, structures = benzoate_file(4)
+
+    with pymaeparser.MaeWriter(tmp_path / "out.mae") as writer:
+        for props, raw in pymaeparser.iter_mae_raw(path):
+            assert isinstance(raw, memoryview)
+            assert bytes(raw).startswith(b"f_m_ct {")
+            assert props["i_m_prop_b"] == structures[0]["props"]["i_m_prop_b"]
+
+            if props["s_m_title"] != "benzoate-1":
+                writer.write_raw(raw)
+
+        writer.write(structures[1])
+
+    assert pymaeparser.read_mae(tmp_path / "out.mae") == [
+        structures[0],
+        *structures[2:],
+        structures[1],
+    ]